@@ -1,187 +1,186 @@
 #include <lexer/lexer.h>
 #include <parser/parser.h>
 #include <codegen/codegen.h>
+#include <codegen/optimize.h>
+#include <util/spscqueue.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/raw_ostream.h>
 #include <cstdio>
+#include <thread>
 
 namespace s = std;
 namespace pg = llvmpg;
 namespace k = pg::k;
 
-// Forward declarations
-s::unique_ptr<k::ExprAST> ParseExpressionCodegen();
-s::unique_ptr<k::ExprAST> ParseParenExprCodegen();
-
 //===----------------------------------------------------------------------===//
-// Codegen-specific parsing overrides
+// Command line options
 //===----------------------------------------------------------------------===//
 
-// Override the parser functions to return codegen versions
-s::unique_ptr<k::ExprAST> ParseNumberExprCodegen() {
-  auto Result = k::CreateNumberExprCodegen(k::NumVal);
-  k::getNextToken(); // consume the number
-  return s::move(Result);
-}
-
-s::unique_ptr<k::ExprAST> ParseIdentifierExprCodegen() {
-  s::string IdName = k::IdentifierStr;
+static llvm::cl::opt<bool> WholeProgram(
+    "whole-program",
+    llvm::cl::desc("Treat the input as the whole program: keep top-level expressions, "
+                   "infer function attributes and run interprocedural optimization"),
+    llvm::cl::init(false));
+
+static llvm::cl::list<s::string> Exports(
+    "export", llvm::cl::desc("With -whole-program, definitions to keep externally visible"),
+    llvm::cl::CommaSeparated);
+
+static llvm::cl::opt<unsigned> OptLevel(
+    "O", llvm::cl::desc("Optimization level for -whole-program (0-3)"),
+    llvm::cl::Prefix, llvm::cl::init(2));
+
+static llvm::cl::opt<bool> Pipeline(
+    "pipeline",
+    llvm::cl::desc("Lex and parse on a thread of their own, ahead of code generation "
+                   "(not with -hash-cons; no prompts)"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> QueueDepth(
+    "queue-depth", llvm::cl::desc("Items parsed ahead of code generation with -pipeline"),
+    llvm::cl::init(64));
+
+static llvm::cl::opt<s::string> FastMath(
+    "fast-math",
+    llvm::cl::desc("Fast-math flags for all functions, e.g. reassoc,contract,nnan or fast"),
+    llvm::cl::init(""));
+
+static llvm::cl::list<s::string> FnFastMath(
+    "fn-fast-math",
+    llvm::cl::desc("Fast-math flags for one function, as <name>:<flags>"));
+
+static llvm::cl::opt<k::FPContract> FPContract(
+    "fp-contract", llvm::cl::desc("Floating point multiply-add contraction"),
+    llvm::cl::init(k::FPC_Off),
+    llvm::cl::values(clEnumValN(k::FPC_Off, "off", "never fuse"),
+                     clEnumValN(k::FPC_On, "on", "fuse a*b+c within an expression"),
+                     clEnumValN(k::FPC_Fast, "fast", "let the backend fuse anywhere")));
+
+static llvm::cl::opt<s::string> MCPU(
+    "mcpu", llvm::cl::desc("Target CPU for generated functions, or 'native'"),
+    llvm::cl::init(""));
+
+static llvm::cl::opt<s::string> MAttr(
+    "mattr", llvm::cl::desc("Target features for generated functions, e.g. +avx2,+fma"),
+    llvm::cl::init(""));
+
+static llvm::cl::opt<bool> InferTypes(
+    "infer-types",
+    llvm::cl::desc("Specialize functions to integer or float arithmetic where provable"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> RelaxedFloat(
+    "relaxed-float",
+    llvm::cl::desc("With -infer-types, allow single precision for float literals"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<k::VectorLibrary> VecLib(
+    "veclib", llvm::cl::desc("Vector math library for vectorized math calls"),
+    llvm::cl::init(k::VL_None),
+    llvm::cl::values(clEnumValN(k::VL_None, "none", "no vector library"),
+                     clEnumValN(k::VL_LIBMVEC, "libmvec", "GLIBC vector math library"),
+                     clEnumValN(k::VL_SVML, "svml", "Intel short vector math library"),
+                     clEnumValN(k::VL_Accelerate, "accelerate", "Apple Accelerate"),
+                     clEnumValN(k::VL_MASSV, "massv", "IBM MASS vector library")));
+
+static llvm::cl::opt<bool> DebugInfo(
+    "g", llvm::cl::desc("Emit debug info with the source line of every expression"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> PartialEval(
+    "partial-eval",
+    llvm::cl::desc("Specialize calls with constant arguments, folding those that compute "
+                   "a constant"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> SpecializeBudget(
+    "specialize-budget",
+    llvm::cl::desc("AST nodes each module may clone with -partial-eval"),
+    llvm::cl::init(2000));
+
+static llvm::cl::opt<bool> HashCons(
+    "hash-cons",
+    llvm::cl::desc("Share structurally identical subexpressions in the AST and emit "
+                   "each once per function"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> Throughput(
+    "throughput",
+    llvm::cl::desc("Compile as fast as possible: discard IR value names and skip the "
+                   "verifier, prompts and IR printing (re-enable with -verify, -print-ir)"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> Verify(
+    "verify", llvm::cl::desc("Verify the IR of every function (default: unless -throughput)"),
+    llvm::cl::init(true));
+
+static llvm::cl::opt<bool> PrintIR(
+    "print-ir",
+    llvm::cl::desc("Print the IR of every item and the module (default: unless -throughput)"),
+    llvm::cl::init(true));
+
+static llvm::cl::opt<unsigned> MaxNestingDepth(
+    "max-nesting-depth",
+    llvm::cl::desc("Reject expressions with more nested parentheses and calls (0: no limit)"),
+    llvm::cl::init(0));
+
+// What the driver prints besides errors.
+static bool ShowIR = true;
+static bool ShowPrompt = true;
 
-  k::getNextToken(); // eat identifier.
-
-  if (k::CurTok != '(') // Simple variable ref.
-    return k::CreateVariableExprCodegen(IdName);
-
-  // Call.
-  k::getNextToken(); // eat (
-  s::vector<s::unique_ptr<k::ExprAST>> Args;
-  if (k::CurTok != ')') {
-    while (true) {
-      if (auto Arg = ParseExpressionCodegen())
-        Args.push_back(s::move(Arg));
-      else
-        return nullptr;
-
-      if (k::CurTok == ')')
-        break;
-
-      if (k::CurTok != ',')
-        return k::LogError("Expected ')' or ',' in argument list");
-      k::getNextToken();
-    }
-  }
+//===----------------------------------------------------------------------===//
+// Top-Level parsing and JIT Driver
+//===----------------------------------------------------------------------===//
 
-  // Eat the ')'.
-  k::getNextToken();
+// Names of the top-level expressions kept with -whole-program.
+s::vector<s::string> AnonExprs;
 
-  return k::CreateCallExprCodegen(IdName, s::move(Args));
+/// AnonExprName - Name for the next top-level expression.  A whole program
+/// keeps every expression, so each needs a name of its own.
+s::string AnonExprName() {
+  if (not WholeProgram)
+    return "__anon_expr";
+  AnonExprs.push_back("__anon_expr" + s::to_string(AnonExprs.size()));
+  return AnonExprs.back();
 }
 
-s::unique_ptr<k::ExprAST> ParsePrimaryCodegen() {
-  switch (k::CurTok) {
-  default:
-    return k::LogError("unknown token when expecting an expression");
-  case k::tok_identifier:
-    return ParseIdentifierExprCodegen();
-  case k::tok_number:
-    return ParseNumberExprCodegen();
-  case '(':
-    return ParseParenExprCodegen();
+void EmitDefinition(k::FunctionAST &FnAST) {
+  if (auto *FnIR = FnAST.codegen()) {
+    if (ShowIR) {
+      fprintf(stderr, "Read function definition:");
+      FnIR->print(llvm::errs());
+      fprintf(stderr, "\n");
+    }
   }
 }
 
-s::unique_ptr<k::ExprAST> ParseParenExprCodegen() {
-  k::getNextToken(); // eat (.
-  auto V = ParseExpressionCodegen();
-  if (not V)
-    return nullptr;
-
-  if (k::CurTok != ')')
-    return k::LogError("expected ')'");
-  k::getNextToken(); // eat ).
-  return V;
-}
-
-s::unique_ptr<k::ExprAST> ParseBinOpRHSCodegen(int ExprPrec,
-                                               s::unique_ptr<k::ExprAST> LHS) {
-  // If this is a binop, find its precedence.
-  while (true) {
-    int TokPrec = k::GetTokPrecedence();
-
-    // If this is a binop that binds at least as tightly as the current binop,
-    // consume it, otherwise we are done.
-    if (TokPrec < ExprPrec)
-      return LHS;
-
-    // Okay, we know this is a binop.
-    int BinOp = k::CurTok;
-    k::getNextToken(); // eat binop
-
-    // Parse the primary expression after the binary operator.
-    auto RHS = ParsePrimaryCodegen();
-    if (not RHS)
-      return nullptr;
-
-    // If BinOp binds less tightly with RHS than the operator after RHS, let
-    // the pending operator take RHS as its LHS.
-    int NextPrec = k::GetTokPrecedence();
-    if (TokPrec < NextPrec) {
-      RHS = ParseBinOpRHSCodegen(TokPrec + 1, s::move(RHS));
-      if (not RHS)
-        return nullptr;
+void EmitExtern(k::PrototypeAST &ProtoAST) {
+  if (auto *FnIR = ProtoAST.codegen()) {
+    if (ShowIR) {
+      fprintf(stderr, "Read extern: ");
+      FnIR->print(llvm::errs());
+      fprintf(stderr, "\n");
     }
-
-    // Merge LHS/RHS.
-    LHS = k::CreateBinaryExprCodegen(BinOp, s::move(LHS), s::move(RHS));
   }
 }
 
-s::unique_ptr<k::ExprAST> ParseExpressionCodegen() {
-  auto LHS = ParsePrimaryCodegen();
-  if (not LHS)
-    return nullptr;
-
-  return ParseBinOpRHSCodegen(0, s::move(LHS));
-}
-
-s::unique_ptr<k::PrototypeAST> ParsePrototypeCodegen() {
-  if (k::CurTok != k::tok_identifier)
-    return k::LogErrorP("Expected function name in prototype");
-
-  s::string FnName = k::IdentifierStr;
-  k::getNextToken();
-
-  if (k::CurTok != '(')
-    return k::LogErrorP("Expected '(' in prototype");
-
-  s::vector<s::string> ArgNames;
-  while (k::getNextToken() == k::tok_identifier)
-    ArgNames.push_back(k::IdentifierStr);
-  if (k::CurTok != ')')
-    return k::LogErrorP("Expected ')' in prototype");
-
-  // success.
-  k::getNextToken(); // eat ')'.
-
-  return k::CreatePrototypeCodegen(FnName, s::move(ArgNames));
-}
-
-s::unique_ptr<k::FunctionAST> ParseDefinitionCodegen() {
-  k::getNextToken(); // eat def.
-  auto Proto = ParsePrototypeCodegen();
-  if (not Proto)
-    return nullptr;
-
-  if (auto E = ParseExpressionCodegen())
-    return k::CreateFunctionCodegen(s::move(Proto), s::move(E));
-  return nullptr;
-}
+void EmitTopLevelExpression(k::FunctionAST &FnAST) {
+  if (auto *FnIR = FnAST.codegen()) {
+    if (ShowIR) {
+      fprintf(stderr, "Read top-level expression:");
+      FnIR->print(llvm::errs());
+      fprintf(stderr, "\n");
+    }
 
-s::unique_ptr<k::FunctionAST> ParseTopLevelExprCodegen() {
-  if (auto E = ParseExpressionCodegen()) {
-    // Make an anonymous proto.
-    auto Proto = k::CreatePrototypeCodegen("__anon_expr",
-                                           s::vector<s::string>());
-    return k::CreateFunctionCodegen(s::move(Proto), s::move(E));
+    // Remove the anonymous expression.
+    if (not WholeProgram)
+      FnIR->eraseFromParent();
   }
-  return nullptr;
-}
-
-s::unique_ptr<k::PrototypeAST> ParseExternCodegen() {
-  k::getNextToken(); // eat extern.
-  return ParsePrototypeCodegen();
 }
 
-//===----------------------------------------------------------------------===//
-// Top-Level parsing and JIT Driver
-//===----------------------------------------------------------------------===//
-
 void HandleDefinition() {
-  if (auto FnAST = ParseDefinitionCodegen()) {
-    if (auto *FnIR = FnAST->codegen()) {
-      fprintf(stderr, "Read function definition:");
-      FnIR->print(llvm::errs());
-      fprintf(stderr, "\n");
-    }
+  if (auto FnAST = k::ParseDefinition()) {
+    EmitDefinition(*FnAST);
   } else {
     // Skip token for error recovery.
     k::getNextToken();
@@ -189,12 +188,8 @@ void HandleDefinition() {
 }
 
 void HandleExtern() {
-  if (auto ProtoAST = ParseExternCodegen()) {
-    if (auto *FnIR = ProtoAST->codegen()) {
-      fprintf(stderr, "Read extern: ");
-      FnIR->print(llvm::errs());
-      fprintf(stderr, "\n");
-    }
+  if (auto ProtoAST = k::ParseExtern()) {
+    EmitExtern(*ProtoAST);
   } else {
     // Skip token for error recovery.
     k::getNextToken();
@@ -203,15 +198,8 @@ void HandleExtern() {
 
 void HandleTopLevelExpression() {
   // Evaluate a top-level expression into an anonymous function.
-  if (auto FnAST = ParseTopLevelExprCodegen()) {
-    if (auto *FnIR = FnAST->codegen()) {
-      fprintf(stderr, "Read top-level expression:");
-      FnIR->print(llvm::errs());
-      fprintf(stderr, "\n");
-
-      // Remove the anonymous expression.
-      FnIR->eraseFromParent();
-    }
+  if (auto FnAST = k::ParseTopLevelExpr(AnonExprName())) {
+    EmitTopLevelExpression(*FnAST);
   } else {
     // Skip token for error recovery.
     k::getNextToken();
@@ -221,7 +209,8 @@ void HandleTopLevelExpression() {
 /// top ::= definition | external | expression | ';'
 void MainLoop() {
   while (true) {
-    fprintf(stderr, "ready> ");
+    if (ShowPrompt)
+      fprintf(stderr, "ready> ");
     switch (k::CurTok) {
     case k::tok_eof:
       return;
@@ -241,11 +230,88 @@ void MainLoop() {
   }
 }
 
+/// PipelinedLoop - MainLoop with lexing and parsing on a thread of their
+/// own, up to -queue-depth items ahead of code generation.
+void PipelinedLoop() {
+  pg::SPSCQueue<k::TopLevelItem> Items(QueueDepth);
+  s::thread Parser([&Items]() {
+    while (true) {
+      k::TopLevelItem Item = k::ParseTopLevelItem(AnonExprName);
+      if (Item.Kind == k::IK_End)
+        break;
+      Items.push(s::move(Item));
+    }
+    Items.close();
+  });
+
+  k::TopLevelItem Item;
+  while (Items.pop(Item)) {
+    switch (Item.Kind) {
+    case k::IK_Definition:
+      if (Item.Function)
+        EmitDefinition(*Item.Function);
+      break;
+    case k::IK_Extern:
+      if (Item.Proto)
+        EmitExtern(*Item.Proto);
+      break;
+    default:
+      if (Item.Function)
+        EmitTopLevelExpression(*Item.Function);
+      break;
+    }
+  }
+  Parser.join();
+}
+
+/// ParseOptions - Fill in the codegen options from the command line.
+/// Returns false on a malformed option.
+bool ParseOptions() {
+  if (not k::ParseFastMathFlags(k::Options.FastMath, FastMath)) {
+    fprintf(stderr, "Error: invalid -fast-math flags '%s'\n", FastMath.c_str());
+    return false;
+  }
+  k::Options.Contract = FPContract;
+  k::Options.TargetCPU = MCPU;
+  k::Options.TargetFeatures = MAttr;
+  k::Options.InferTypes = InferTypes;
+  k::Options.RelaxedFloat = RelaxedFloat;
+  k::Options.VecLib = VecLib;
+  k::Options.DebugInfo = DebugInfo;
+  k::Options.PartialEval = PartialEval;
+  k::Options.SpecializeBudget = SpecializeBudget;
+  // Throughput mode drops the diagnostics not asked for explicitly.
+  bool Diagnostics = not Throughput;
+  k::Options.Verify = Verify.getNumOccurrences() ? Verify : Diagnostics;
+  k::Options.DiscardValueNames = Throughput;
+  ShowIR = PrintIR.getNumOccurrences() ? PrintIR : Diagnostics;
+  ShowPrompt = Diagnostics and not Pipeline;
+  k::ResolveTargetCPU(k::Options);
+  k::MaxNestingDepth = MaxNestingDepth;
+
+  for (const s::string &Spec : FnFastMath) {
+    size_t Colon = Spec.find(':');
+    k::CodegenOptions FnOptions = k::Options;
+    FnOptions.FastMath.clear();
+    if (Colon == s::string::npos or
+        not k::ParseFastMathFlags(FnOptions.FastMath, Spec.substr(Colon + 1))) {
+      fprintf(stderr, "Error: invalid -fn-fast-math '%s'\n", Spec.c_str());
+      return false;
+    }
+    k::FunctionOptions[Spec.substr(0, Colon)] = FnOptions;
+  }
+  return true;
+}
+
 //===----------------------------------------------------------------------===//
 // Main driver code.
 //===----------------------------------------------------------------------===//
 
-int main() {
+int main(int argc, char **argv) {
+  llvm::cl::ParseCommandLineOptions(argc, argv, "Kaleidoscope code generator\n");
+  if (not ParseOptions())
+    return 1;
+
   // Install standard binary operators.
   // 1 is lowest precedence.
   k::BinopPrecedence['<'] = 10;
@@ -253,18 +319,34 @@ int main() {
   k::BinopPrecedence['-'] = 20;
   k::BinopPrecedence['*'] = 40; // highest.
 
+  // Have the parser build codegen nodes.
+  k::Factory = HashCons ? k::MakeHashConsFactory(k::CodegenFactory) : k::CodegenFactory;
+
   // Prime the first token.
-  fprintf(stderr, "ready> ");
+  if (ShowPrompt)
+    fprintf(stderr, "ready> ");
   k::getNextToken();
 
   // Make the module, which holds all the code.
   k::InitializeModule();
 
-  // Run the main "interpreter loop" now.
-  MainLoop();
+  // Run the main "interpreter loop" now.  The hash-consing factory shares
+  // its table with codegen, so it cannot parse ahead.
+  if (Pipeline and not HashCons)
+    PipelinedLoop();
+  else
+    MainLoop();
+  k::FinalizeDebugInfo();
+
+  if (WholeProgram) {
+    s::vector<s::string> Roots(AnonExprs);
+    Roots.insert(Roots.end(), Exports.begin(), Exports.end());
+    k::OptimizeWholeProgram(*k::TheModule, Roots, OptLevel);
+  }
 
   // Print out all of the generated code.
-  k::TheModule->print(llvm::errs(), nullptr);
+  if (ShowIR)
+    k::TheModule->print(llvm::errs(), nullptr);
 
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,209 @@
+#include <engine/engine.h>
+#include <engine/codearena.h>
+#include <codegen/codegen.h>
+#include <llvm/Support/CommandLine.h>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <thread>
+
+namespace s = std;
+namespace pg = llvmpg;
+namespace k = pg::k;
+
+//===----------------------------------------------------------------------===//
+// Command line options
+//===----------------------------------------------------------------------===//
+
+static llvm::cl::opt<s::string> InputFile(
+    llvm::cl::Positional, llvm::cl::desc("<input .k file>"), llvm::cl::init("-"));
+
+static llvm::cl::opt<unsigned> OptLevel(
+    "O", llvm::cl::desc("Optimization level (0-3)"), llvm::cl::Prefix, llvm::cl::init(2));
+
+static llvm::cl::opt<bool> InferTypes(
+    "infer-types",
+    llvm::cl::desc("Specialize functions to integer or float arithmetic where provable"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> DebugInfo(
+    "g", llvm::cl::desc("Emit debug info with the source line of every expression"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> PerfMap(
+    "perf-map", llvm::cl::desc("Name JIT code for perf in /tmp/perf-<pid>.map"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> PerfJITDump(
+    "perf-jitdump", llvm::cl::desc("Write jitdump files for perf inject --jit"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> GDBRegistration(
+    "gdb-jit", llvm::cl::desc("Register JIT code with the GDB JIT interface"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> Threads(
+    "threads",
+    llvm::cl::desc("Evaluate independent pure top-level expressions on this many threads "
+                   "(0: one after another)"),
+    llvm::cl::init(0));
+
+static llvm::cl::opt<bool> PartialEval(
+    "partial-eval",
+    llvm::cl::desc("Specialize calls with constant arguments, folding those that compute "
+                   "a constant"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> SpecializeBudget(
+    "specialize-budget",
+    llvm::cl::desc("AST nodes each module may clone with -partial-eval"),
+    llvm::cl::init(2000));
+
+static llvm::cl::opt<bool> HashCons(
+    "hash-cons", llvm::cl::desc("Share structurally identical subexpressions"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> Skim(
+    "skim",
+    llvm::cl::desc("Parse and compile the body of a definition only when it is first "
+                   "referenced"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> Pipeline(
+    "pipeline",
+    llvm::cl::desc("Parse, generate IR and compile on separate threads, overlapping the "
+                   "items of the input"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> QueueDepth(
+    "queue-depth", llvm::cl::desc("Items waiting between two stages of -pipeline"),
+    llvm::cl::init(64));
+
+static llvm::cl::opt<unsigned> InlineSize(
+    "inline-size",
+    llvm::cl::desc("Let later callers inline definitions of up to this many IR "
+                   "instructions (0: never)"),
+    llvm::cl::init(50));
+
+static llvm::cl::opt<bool> Throughput(
+    "throughput", llvm::cl::desc("Discard IR value names and skip the IR verifier"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> CodeSlabs(
+    "code-slabs",
+    llvm::cl::desc("Pack the generated code into large shared slabs instead of pages per "
+                   "module"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> HugePages(
+    "huge-pages", llvm::cl::desc("Back the code slabs with transparent huge pages"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> SlabKiB(
+    "slab-size", llvm::cl::desc("Size of a code slab in KiB"), llvm::cl::init(64));
+
+static llvm::cl::list<s::string> HotFunctions(
+    "hot",
+    llvm::cl::desc("Definitions to place together with their callers in the hot code slabs, "
+                   "e.g. from a profile"),
+    llvm::cl::CommaSeparated);
+
+static llvm::cl::opt<bool> CodeStats(
+    "code-stats", llvm::cl::desc("Print the code memory usage after compiling"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> Watch(
+    "watch",
+    llvm::cl::desc("Keep running and recompile the input whenever it changes; only "
+                   "edited definitions (and callers that depend on them) are recompiled, "
+                   "but every top-level expression runs again, side effects included, "
+                   "and definitions deleted from the input stay defined"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> WatchInterval(
+    "watch-interval", llvm::cl::desc("Milliseconds between checks of the input with -watch"),
+    llvm::cl::init(200));
+
+//===----------------------------------------------------------------------===//
+// Main driver code.
+//===----------------------------------------------------------------------===//
+
+/// Run - Compile the input and print the values of its top-level expressions.
+bool Run(k::Engine &E) {
+  s::vector<double> Results;
+  bool Ok;
+  if (InputFile == "-") {
+    s::string Source((s::istreambuf_iterator<char>(s::cin)), s::istreambuf_iterator<char>());
+    Ok = E.compile(Results, Source);
+  } else {
+    Ok = E.compileFile(Results, InputFile);
+  }
+  for (double V : Results)
+    fprintf(stderr, "Evaluated to %f\n", V);
+  if (CodeStats) {
+    k::CodeMemoryStats S = E.codeMemoryStats();
+    fprintf(stderr,
+            "Code memory: %zu objects, %zu bytes used of %zu committed in %zu slabs "
+            "(%.1f%% fragmentation), %zu free slabs, %zu reserved%s\n",
+            S.Objects, S.Used, S.Committed, S.Slabs, 100 * S.fragmentation(), S.FreeSlabs,
+            S.Reserved, S.HugePages ? ", huge pages" : "");
+  }
+  return Ok;
+}
+
+int main(int argc, char **argv) {
+  llvm::cl::ParseCommandLineOptions(argc, argv, "Kaleidoscope JIT\n");
+  if (Watch and InputFile == "-") {
+    fprintf(stderr, "Error: -watch needs an input file\n");
+    return 1;
+  }
+
+  k::Options.InferTypes = InferTypes;
+  k::Options.DebugInfo = DebugInfo;
+  k::Options.Verify = not Throughput;
+  k::Options.DiscardValueNames = Throughput;
+  k::Options.PartialEval = PartialEval;
+  k::Options.SpecializeBudget = SpecializeBudget;
+  if (InputFile != "-")
+    k::Options.SourceFile = InputFile;
+
+  k::EngineOptions Opts;
+  Opts.OptLevel = OptLevel;
+  Opts.PerfMap = PerfMap;
+  Opts.PerfJITDump = PerfJITDump;
+  Opts.GDBRegistration = GDBRegistration;
+  Opts.Threads = Threads;
+  Opts.HashCons = HashCons;
+  Opts.Skim = Skim;
+  Opts.Pipeline = Pipeline;
+  Opts.QueueDepth = QueueDepth;
+  Opts.InlineSize = InlineSize;
+  Opts.CodeSlabs = CodeSlabs;
+  Opts.HugePages = HugePages;
+  Opts.SlabSize = size_t(SlabKiB) << 10;
+  Opts.HotFunctions.insert(HotFunctions.begin(), HotFunctions.end());
+  k::Engine E(Opts);
+
+  bool Ok = Run(E);
+  if (not Watch)
+    return Ok ? 0 : 1;
+
+  namespace fs = s::filesystem;
+  s::error_code EC;
+  fs::file_time_type Stamp = fs::last_write_time(InputFile.getValue(), EC);
+  while (true) {
+    s::this_thread::sleep_for(s::chrono::milliseconds(WatchInterval));
+    fs::file_time_type Now = fs::last_write_time(InputFile.getValue(), EC);
+    if (EC or Now == Stamp)
+      continue;
+    Stamp = Now;
+
+    auto Start = s::chrono::steady_clock::now();
+    Run(E);
+    auto Elapsed = s::chrono::duration_cast<s::chrono::microseconds>(
+        s::chrono::steady_clock::now() - Start);
+    fprintf(stderr, "Reloaded %s in %.3f ms\n", InputFile.c_str(), Elapsed.count() / 1000.0);
+  }
+}
@@ -0,0 +1,275 @@
+#include <engine/engine.h>
+#include <llvm/Support/CommandLine.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace s = std;
+namespace pg = llvmpg;
+namespace k = pg::k;
+
+//===----------------------------------------------------------------------===//
+// Command line options
+//===----------------------------------------------------------------------===//
+
+static llvm::cl::list<s::string> KernelFiles(
+    llvm::cl::Positional,
+    llvm::cl::desc("<kernel .k files> (default: every kernel in " KBENCH_KERNEL_DIR ")"));
+
+static llvm::cl::list<unsigned> OptLevels(
+    "levels", llvm::cl::desc("Optimization levels to compile the kernels at (default: 0,1,2,3)"),
+    llvm::cl::CommaSeparated);
+
+static llvm::cl::opt<unsigned> Samples(
+    "samples", llvm::cl::desc("Timed samples per kernel and reference"), llvm::cl::init(15));
+
+static llvm::cl::opt<double> SampleMs(
+    "sample-ms", llvm::cl::desc("Minimum duration of one sample, in milliseconds"),
+    llvm::cl::init(5));
+
+static llvm::cl::opt<double> MaxRatio(
+    "max-ratio",
+    llvm::cl::desc("Fail when a kernel at -O2 or above is slower than its reference by more "
+                   "than this ratio, beyond the noise (0: only report)"),
+    llvm::cl::init(0));
+
+//===----------------------------------------------------------------------===//
+// C++ references
+//===----------------------------------------------------------------------===//
+
+// Hand-written equivalents of the kernels in bench/, computing the same
+// values in the same order (the target is built with -ffp-contract=off).
+
+static double Fib1(double) { return 1; }
+static double Fib2(double x) { return x; }
+static double Fib3(double x) { return Fib2(x) + Fib1(x); }
+static double Fib4(double x) { return Fib3(x) + Fib2(x); }
+static double Fib5(double x) { return Fib4(x) + Fib3(x); }
+static double Fib6(double x) { return Fib5(x) + Fib4(x); }
+static double Fib7(double x) { return Fib6(x) + Fib5(x); }
+static double Fib8(double x) { return Fib7(x) + Fib6(x); }
+static double Fib9(double x) { return Fib8(x) + Fib7(x); }
+static double Fib10(double x) { return Fib9(x) + Fib8(x); }
+static double Fib11(double x) { return Fib10(x) + Fib9(x); }
+static double Fib12(double x) { return Fib11(x) + Fib10(x); }
+static double Fib13(double x) { return Fib12(x) + Fib11(x); }
+static double Fib14(double x) { return Fib13(x) + Fib12(x); }
+static double Fib15(double x) { return Fib14(x) + Fib13(x); }
+static double Fib16(double x) { return Fib15(x) + Fib14(x); }
+static double Fib17(double x) { return Fib16(x) + Fib15(x); }
+static double Fib18(double x) { return Fib17(x) + Fib16(x); }
+
+static double FibRef(double X) { return Fib18(X); }
+
+static double TrigRef(double X) { return s::atan2(s::sin(X * .4), s::cos(X * 42)); }
+
+static double Horner(double x) {
+  return ((((((((((0.5 * x + 0.25) * x - 1.5) * x + 2) * x - 0.75) * x + 1.25) * x
+      - 3) * x + 0.125) * x + 4) * x - 2.5) * x + 1);
+}
+
+static double Quadratic(double x, double a, double b, double c) {
+  return a*x*x + b*x + c;
+}
+
+static double PolyRef(double X) {
+  return Horner(X) + Quadratic(X, 3, 0.5, 2) - Quadratic(X, 0.25, 1, 4);
+}
+
+static double ExpSeries(double x) {
+  return 1 + x + x*x*0.5 + x*x*x*0.16666666666666666 + x*x*x*x*0.041666666666666664
+      + x*x*x*x*x*0.008333333333333333 + x*x*x*x*x*x*0.001388888888888889
+      + x*x*x*x*x*x*x*0.0001984126984126984
+      + x*x*x*x*x*x*x*x*0.0000248015873015873
+      + x*x*x*x*x*x*x*x*x*0.0000027557319223985893;
+}
+
+static double SinSeries(double x) {
+  return x - x*x*x*0.16666666666666666 + x*x*x*x*x*0.008333333333333333
+      - x*x*x*x*x*x*x*0.0001984126984126984
+      + x*x*x*x*x*x*x*x*x*0.0000027557319223985893;
+}
+
+static double SeriesRef(double X) { return ExpSeries(X) * SinSeries(X); }
+
+static double ChainRef(double x) {
+  return ((((((((((((((((((((((((((((((((((((((((((((((((x*0.8238 + x*0.6983)
+      *0.5724 - 0.0718)*1.0828 + 0.8194)*0.5375 + 0.1327)*0.7407 + 0.1021)
+      *1.3269 + 0.7524)*1.1306 + x*0.166)*1.0771 + 0.2066)*0.5466 - 0.7169)
+      *0.9191 - 0.0814)*1.0603 + 0.364)*1.0816 - 0.2778)*0.5974 + x*0.4242)
+      *1.119 - 0.0072)*1.2772 - 0.0688)*0.8616 + 0.5031)*1.199 - 0.5118)
+      *1.0252 - 0.7503)*0.7879 + x*0.9603)*1.0119 - 0.6701)*0.652 + 0.0221)
+      *1.462 - 0.8448)*0.8401 - 0.2996)*1.0799 + 0.0876)*1.4447 + x*0.0518)
+      *0.5607 - 0.403)*0.7846 - 0.2284)*0.5226 + 0.0766)*1.1109 + 0.0126)
+      *1.2682 + 0.7413)*0.8979 - x*0.8336)*0.5806 - 0.1016)*1.3834 - 0.6386)
+      *1.2064 - 0.9729)*1.4577 + 0.6982)*0.6513 + 0.317)*0.985 - x*0.1782)
+      *0.7819 - 0.7086)*1.1098 + 0.3628)*1.1905 + 0.031)*0.9566 - 0.742)
+      *0.8981 - 0.2118)*1.1343 + x*0.8755)*1.4847 + 0.1187)*0.8401 + 0.8948)
+      *1.0668 - 0.0732)*1.1137 + 0.8594)*1.1141 - 0.7029);
+}
+
+/// Reference - The C++ equivalent of the function "kernel" in Name.k.
+struct Reference {
+  const char *Name;
+  double (*Fn)(double);
+};
+
+static const Reference References[] = {
+    {"fib", FibRef},       {"trig", TrigRef},   {"poly", PolyRef},
+    {"series", SeriesRef}, {"chain", ChainRef},
+};
+
+//===----------------------------------------------------------------------===//
+// Measurement
+//===----------------------------------------------------------------------===//
+
+/// Timing - Time per call over the samples, in nanoseconds: the median, and
+/// the median absolute deviation from it as the measure of noise.
+struct Timing {
+  double Median;
+  double MAD;
+};
+
+static double Median(s::vector<double> V) {
+  s::sort(V.begin(), V.end());
+  size_t N = V.size();
+  return N % 2 ? V[N / 2] : (V[N / 2 - 1] + V[N / 2]) / 2;
+}
+
+// Read through a volatile so the compiler cannot see which function is
+// measured, and calls references exactly like JIT code: through a pointer.
+static double (*volatile Target)(double);
+static volatile double Sink;
+
+/// RunSample - Call Target on every input Reps times; returns the seconds taken.
+static double RunSample(const s::vector<double> &Inputs, unsigned Reps) {
+  double (*Fn)(double) = Target;
+  double Sum = 0;
+  auto Start = s::chrono::steady_clock::now();
+  for (unsigned r = 0; r != Reps; ++r)
+    for (double X : Inputs)
+      Sum += Fn(X);
+  auto End = s::chrono::steady_clock::now();
+  Sink = Sum;
+  return s::chrono::duration<double>(End - Start).count();
+}
+
+/// Measure - Time Fn over Inputs.  The repetitions are calibrated first, so
+/// that every sample lasts at least -sample-ms.
+static Timing Measure(double (*Fn)(double), const s::vector<double> &Inputs) {
+  Target = Fn;
+  unsigned Reps = 1;
+  while (RunSample(Inputs, Reps) < SampleMs / 1000 and Reps < (1u << 30))
+    Reps *= 2;
+
+  s::vector<double> PerCall;
+  for (unsigned i = 0; i != Samples; ++i)
+    PerCall.push_back(RunSample(Inputs, Reps) * 1e9 / (double(Reps) * Inputs.size()));
+
+  Timing T;
+  T.Median = Median(PerCall);
+  for (double &V : PerCall)
+    V = s::fabs(V - T.Median);
+  T.MAD = Median(PerCall);
+  return T;
+}
+
+/// MaxRelativeError - The largest relative difference of Fn from Ref on
+/// Inputs.
+static double MaxRelativeError(double (*Fn)(double), double (*Ref)(double),
+                               const s::vector<double> &Inputs) {
+  double Max = 0;
+  for (double X : Inputs) {
+    double A = Fn(X), B = Ref(X);
+    Max = s::max(Max, s::fabs(A - B) / s::max(1.0, s::fabs(B)));
+  }
+  return Max;
+}
+
+//===----------------------------------------------------------------------===//
+// Main driver code.
+//===----------------------------------------------------------------------===//
+
+int main(int argc, char **argv) {
+  llvm::cl::ParseCommandLineOptions(
+      argc, argv,
+      "Kaleidoscope kernel benchmarks\n\n"
+      "  Times the function 'kernel' of each .k file, compiled by the engine at\n"
+      "  each optimization level, against a C++ reference.  A ratio is only\n"
+      "  reported as faster or slower when the medians differ by more than three\n"
+      "  times the combined noise (scaled median absolute deviation).\n");
+
+  s::vector<s::string> Files(KernelFiles.begin(), KernelFiles.end());
+  if (Files.empty()) {
+    for (auto &Entry : s::filesystem::directory_iterator(KBENCH_KERNEL_DIR))
+      if (Entry.path().extension() == ".k")
+        Files.push_back(Entry.path().string());
+    s::sort(Files.begin(), Files.end());
+  }
+  s::vector<unsigned> Levels = {0, 1, 2, 3};
+  if (not OptLevels.empty())
+    Levels.assign(OptLevels.begin(), OptLevels.end());
+
+  s::vector<double> Inputs;
+  for (int i = 0; i != 1024; ++i)
+    Inputs.push_back(-2 + 4.0 * i / 1023);
+
+  bool Ok = true;
+  printf("%-8s %-4s %18s %18s %8s  %s\n", "kernel", "opt", "ns/call (MAD)",
+         "C++ ns/call (MAD)", "ratio", "verdict");
+  for (const s::string &File : Files) {
+    s::string Name = s::filesystem::path(File).stem().string();
+    const Reference *Ref = nullptr;
+    for (const Reference &R : References)
+      if (Name == R.Name)
+        Ref = &R;
+    Timing RefTime = {0, 0};
+    if (Ref)
+      RefTime = Measure(Ref->Fn, Inputs);
+
+    for (unsigned Level : Levels) {
+      // The front end is global, so one engine at a time.
+      k::EngineOptions Opts;
+      Opts.OptLevel = Level;
+      k::Engine E(Opts);
+      auto *Kernel = E.compileFile(File) ? E.lookup<double(double)>("kernel") : nullptr;
+      if (not Kernel) {
+        printf("%-8s -O%-2u failed to compile\n", Name.c_str(), Level);
+        Ok = false;
+        continue;
+      }
+      Timing T = Measure(Kernel, Inputs);
+      printf("%-8s -O%-2u %10.2f (%5.2f)", Name.c_str(), Level, T.Median, T.MAD);
+      if (not Ref) {
+        printf("%18s %8s  no reference\n", "-", "-");
+        continue;
+      }
+
+      double Ratio = T.Median / RefTime.Median;
+      double Noise = 3 * 1.4826 * (T.MAD + RefTime.MAD);
+      const char *Verdict = "within noise";
+      if (T.Median - RefTime.Median > Noise)
+        Verdict = "slower";
+      else if (RefTime.Median - T.Median > Noise)
+        Verdict = "faster";
+      printf(" %10.2f (%5.2f) %8.3f  %s", RefTime.Median, RefTime.MAD, Ratio, Verdict);
+
+      double Error = MaxRelativeError(Kernel, Ref->Fn, Inputs);
+      if (Error > 1e-9) {
+        printf(", result differs by %g", Error);
+        Ok = false;
+      }
+      if (MaxRatio > 0 and Level >= 2 and Ratio > MaxRatio and
+          T.Median - MaxRatio * RefTime.Median > Noise) {
+        printf(", above -max-ratio");
+        Ok = false;
+      }
+      printf("\n");
+    }
+  }
+  return Ok ? 0 : 1;
+}
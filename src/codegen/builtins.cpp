@@ -0,0 +1,59 @@
+#include <codegen/builtins.h>
+#include <algorithm>
+
+namespace llvmpg {
+namespace k {
+
+namespace s = std;
+
+//===----------------------------------------------------------------------===//
+// Math Builtins
+//===----------------------------------------------------------------------===//
+
+// Sorted by name, for binary search.
+static const Builtin Builtins[] = {
+    {"acos", 1, llvm::Intrinsic::not_intrinsic},
+    {"asin", 1, llvm::Intrinsic::not_intrinsic},
+    {"atan", 1, llvm::Intrinsic::not_intrinsic},
+    {"atan2", 2, llvm::Intrinsic::not_intrinsic},
+    {"cbrt", 1, llvm::Intrinsic::not_intrinsic},
+    {"ceil", 1, llvm::Intrinsic::ceil},
+    {"copysign", 2, llvm::Intrinsic::copysign},
+    {"cos", 1, llvm::Intrinsic::cos},
+    {"cosh", 1, llvm::Intrinsic::not_intrinsic},
+    {"exp", 1, llvm::Intrinsic::exp},
+    {"exp2", 1, llvm::Intrinsic::exp2},
+    {"fabs", 1, llvm::Intrinsic::fabs},
+    {"floor", 1, llvm::Intrinsic::floor},
+    {"fma", 3, llvm::Intrinsic::fma},
+    {"fmax", 2, llvm::Intrinsic::maxnum},
+    {"fmin", 2, llvm::Intrinsic::minnum},
+    {"fmod", 2, llvm::Intrinsic::not_intrinsic},
+    {"hypot", 2, llvm::Intrinsic::not_intrinsic},
+    {"log", 1, llvm::Intrinsic::log},
+    {"log10", 1, llvm::Intrinsic::log10},
+    {"log2", 1, llvm::Intrinsic::log2},
+    {"pow", 2, llvm::Intrinsic::pow},
+    {"round", 1, llvm::Intrinsic::round},
+    {"sin", 1, llvm::Intrinsic::sin},
+    {"sinh", 1, llvm::Intrinsic::not_intrinsic},
+    {"sqrt", 1, llvm::Intrinsic::sqrt},
+    {"tan", 1, llvm::Intrinsic::not_intrinsic},
+    {"tanh", 1, llvm::Intrinsic::not_intrinsic},
+    {"trunc", 1, llvm::Intrinsic::trunc},
+};
+
+s::set<s::string> HostNames;
+
+const Builtin *FindBuiltin(const s::string &Name) {
+  if (HostNames.count(Name))
+    return nullptr;
+  auto It = s::lower_bound(s::begin(Builtins), s::end(Builtins), Name,
+                           [](const Builtin &B, const s::string &N) { return B.Name < N; });
+  if (It == s::end(Builtins) or Name != It->Name)
+    return nullptr;
+  return It;
+}
+
+} // namespace k
+} // namespace llvmpg
@@ -0,0 +1,39 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <llvm/IR/Intrinsics.h>
+#include <set>
+#include <string>
+
+namespace llvmpg {
+namespace k {
+
+namespace s = std;
+
+//===----------------------------------------------------------------------===//
+// Math Builtins
+//===----------------------------------------------------------------------===//
+
+/// Builtin - A standard math function that an extern may name.  Calls to
+/// externs with an intrinsic are lowered to the llvm.* intrinsic, which LLVM
+/// can constant fold and vectorize; the others stay library calls.  All of
+/// them are side effect free (math functions are assumed not to set errno).
+struct Builtin {
+  const char *Name;
+  unsigned Arity;
+  llvm::Intrinsic::ID ID; // llvm::Intrinsic::not_intrinsic if there is none
+};
+
+/// HostNames - Externs bound to host code (see Engine::registerAddress).
+/// They shadow the builtin of the same name: calls to them stay plain calls
+/// and nothing is assumed about their effects.
+extern s::set<s::string> HostNames;
+
+/// FindBuiltin - The builtin called Name, or nullptr if there is none or
+/// Name is bound to host code.
+const Builtin *FindBuiltin(const s::string &Name);
+
+} // namespace k
+} // namespace llvmpg
+
+#endif
@@ -1,16 +1,31 @@
 #include <codegen/codegen.h>
+#include <codegen/builtins.h>
+#include <codegen/typeinfer.h>
 #include <llvm/ADT/APFloat.h>
 #include <llvm/ADT/STLExtras.h>
+#include <llvm/Analysis/ConstantFolding.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Constants.h>
+#include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/DebugInfoMetadata.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/raw_ostream.h>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <set>
+#include <sstream>
 
 namespace llvmpg {
 namespace k {
@@ -25,22 +40,547 @@ s::unique_ptr<llvm::LLVMContext> TheContext;
 s::unique_ptr<llvm::Module> TheModule;
 s::unique_ptr<llvm::IRBuilder<>> Builder;
 s::map<s::string, llvm::Value *> NamedValues;
+s::map<s::string, s::unique_ptr<PrototypeAST>> FunctionProtos;
+
+s::set<s::string> DefinedNames;
 
 llvm::Value *LogErrorV(const char *Str) {
   LogError(Str);
   return nullptr;
 }
 
+//===----------------------------------------------------------------------===//
+// Code Generation Options
+//===----------------------------------------------------------------------===//
+
+CodegenOptions Options;
+s::map<s::string, CodegenOptions> FunctionOptions;
+
+// Options of the function currently being generated.
+static const CodegenOptions *CurOptions = &Options;
+
+const CodegenOptions &GetFunctionOptions(const s::string &Name) {
+  auto It = FunctionOptions.find(Name);
+  if (It == FunctionOptions.end())
+    return Options;
+  return It->second;
+}
+
+bool ParseFastMathFlags(llvm::FastMathFlags &FMF, const s::string &Spec) {
+  s::istringstream In(Spec);
+  s::string Flag;
+  while (s::getline(In, Flag, ',')) {
+    if (Flag == "fast")
+      FMF.setFast();
+    else if (Flag == "reassoc")
+      FMF.setAllowReassoc();
+    else if (Flag == "contract")
+      FMF.setAllowContract();
+    else if (Flag == "nnan")
+      FMF.setNoNaNs();
+    else if (Flag == "ninf")
+      FMF.setNoInfs();
+    else if (Flag == "nsz")
+      FMF.setNoSignedZeros();
+    else if (Flag == "arcp")
+      FMF.setAllowReciprocal();
+    else if (Flag == "afn")
+      FMF.setApproxFunc();
+    else if (Flag == "none" or Flag.empty())
+      continue;
+    else
+      return false;
+  }
+  return true;
+}
+
+void ResolveTargetCPU(CodegenOptions &O) {
+  if (O.TargetCPU != "native")
+    return;
+
+  O.TargetCPU = llvm::sys::getHostCPUName().str();
+  llvm::StringMap<bool> HostFeatures;
+  if (not llvm::sys::getHostCPUFeatures(HostFeatures))
+    return;
+
+  s::string Features;
+  for (auto &F : HostFeatures) {
+    if (not Features.empty())
+      Features += ',';
+    Features += (F.second ? '+' : '-') + F.first().str();
+  }
+  if (not O.TargetFeatures.empty())
+    Features += ',' + O.TargetFeatures;
+  O.TargetFeatures = Features;
+}
+
+void ApplyFunctionOptions(llvm::Function &F, const CodegenOptions &O) {
+  CurOptions = &O;
+  llvm::FastMathFlags FMF = O.FastMath;
+  if (O.Contract == FPC_Fast)
+    FMF.setAllowContract();
+  Builder->setFastMathFlags(FMF);
+
+  // Mirror the instruction flags as function attributes so the backend
+  // (instruction selection, DAG combines) may rely on them too.
+  auto BoolAttr = [&F](const char *Name, bool V) {
+    if (V)
+      F.addFnAttr(Name, "true");
+  };
+  BoolAttr("no-nans-fp-math", FMF.noNaNs());
+  BoolAttr("no-infs-fp-math", FMF.noInfs());
+  BoolAttr("no-signed-zeros-fp-math", FMF.noSignedZeros());
+  BoolAttr("approx-func-fp-math", FMF.approxFunc());
+  BoolAttr("unsafe-fp-math", FMF.isFast());
+
+  if (not O.TargetCPU.empty())
+    F.addFnAttr("target-cpu", O.TargetCPU);
+  if (not O.TargetFeatures.empty())
+    F.addFnAttr("target-features", O.TargetFeatures);
+}
+
+// Values of the shared subtrees emitted in the current function (see
+// SharedExprAST), and the set of those values.  The language has no control
+// flow, so a value emitted once dominates every later use in the function.
+static s::map<const SharedNode *, llvm::Value *> SharedValues;
+static s::set<llvm::Value *> ReusedValues;
+
+/// FuseMulAdd - Contract Mul +/- Addend into llvm.fmuladd when Mul is a
+/// multiply emitted for this very expression (and so has no other users).
+/// NegMul/NegAdd select the sign of the product and of the addend.
+static llvm::Value *FuseMulAdd(llvm::Value *Mul, llvm::Value *Addend,
+                               bool NegMul, bool NegAdd) {
+  auto *I = llvm::dyn_cast<llvm::BinaryOperator>(Mul);
+  if (not I or I->getOpcode() != llvm::Instruction::FMul or not I->use_empty() or
+      ReusedValues.count(I))
+    return nullptr;
+
+  llvm::Value *A = I->getOperand(0);
+  llvm::Value *B = I->getOperand(1);
+  I->eraseFromParent();
+  if (NegMul)
+    A = Builder->CreateFNeg(A, "negtmp");
+  if (NegAdd)
+    Addend = Builder->CreateFNeg(Addend, "negtmp");
+  return Builder->CreateIntrinsic(llvm::Intrinsic::fmuladd, {A->getType()},
+                                  {A, B, Addend}, nullptr, "fmatmp");
+}
+
+// Whether expressions are emitted for a specialized clone, in which values
+// carry the LLVM type of their inferred kind instead of always being double.
+static bool TypedMode = false;
+
+// Magnitude bounds of the i64 values emitted in TypedMode, other than
+// constants (see NumKind).
+static s::map<llvm::Value *, double> IntBounds;
+
+/// BoundOf - Bound on the magnitude of the i64 value V.
+static double BoundOf(llvm::Value *V) {
+  if (auto *C = llvm::dyn_cast<llvm::ConstantInt>(V))
+    return s::fabs(static_cast<double>(C->getSExtValue()));
+  auto It = IntBounds.find(V);
+  return It == IntBounds.end() ? HUGE_VAL : It->second;
+}
+
+/// SetBound - Record the magnitude bound of V, if it is an i64 value.
+static llvm::Value *SetBound(llvm::Value *V, double Bound) {
+  if (V and V->getType()->isIntegerTy() and not llvm::isa<llvm::Constant>(V))
+    IntBounds[V] = Bound;
+  return V;
+}
+
+/// ConvertKind - Convert V to the representation of kind To.
+static llvm::Value *ConvertKind(llvm::Value *V, NumKind To) {
+  NumKind From = KindOf(V->getType());
+  if (From == To)
+    return V;
+
+  llvm::Type *Ty = TypeOf(*TheContext, To);
+  if (From == NK_Int)
+    return Builder->CreateSIToFP(V, Ty, "convtmp");
+  if (To == NK_Int)
+    return Builder->CreateFPToSI(V, Ty, "convtmp");
+  if (From == NK_Float)
+    return Builder->CreateFPExt(V, Ty, "convtmp");
+  return Builder->CreateFPTrunc(V, Ty, "convtmp");
+}
+
+/// EmitIntBinOp - Emit L Op R on i64 operands.
+static llvm::Value *EmitIntBinOp(char Op, llvm::Value *L, llvm::Value *R) {
+  switch (Op) {
+  case '+':
+    return Builder->CreateAdd(L, R, "addtmp");
+  case '-':
+    return Builder->CreateSub(L, R, "subtmp");
+  case '*':
+    return Builder->CreateMul(L, R, "multmp");
+  case '<':
+    L = Builder->CreateICmpSLT(L, R, "cmptmp");
+    return Builder->CreateZExt(L, llvm::Type::getInt64Ty(*TheContext), "booltmp");
+  default:
+    return LogErrorV("invalid binary operator");
+  }
+}
+
+/// EmitIntrinsicCall - Call the double overload of intrinsic ID, folding the
+/// call right away when every argument is a constant.
+static llvm::Value *EmitIntrinsicCall(llvm::Intrinsic::ID ID,
+                                      s::vector<llvm::Value *> Args) {
+  s::vector<llvm::Constant *> Consts;
+  for (auto &V : Args) {
+    V = ConvertKind(V, NK_Double);
+    if (auto *C = llvm::dyn_cast<llvm::Constant>(V))
+      Consts.push_back(C);
+  }
+
+  llvm::CallInst *Call = Builder->CreateIntrinsic(
+      ID, {llvm::Type::getDoubleTy(*TheContext)}, Args, nullptr, "calltmp");
+  if (Consts.size() == Args.size()) {
+    if (llvm::Constant *C = llvm::ConstantFoldCall(Call, Call->getCalledFunction(), Consts)) {
+      Call->eraseFromParent();
+      return C;
+    }
+  }
+  return Call;
+}
+
+llvm::Function *getFunction(const s::string &Name) {
+  // First, see if the function has already been added to the current module.
+  if (llvm::Function *F = TheModule->getFunction(Name))
+    return F;
+
+  // If not, check whether we can codegen the declaration from some existing
+  // prototype.
+  auto FI = FunctionProtos.find(Name);
+  if (FI != FunctionProtos.end())
+    return FI->second->codegen();
+
+  // If no existing prototype exists, return null.
+  return nullptr;
+}
+
+/// SpecFunctionType - The type of the clone specialized to Sig.
+static llvm::FunctionType *SpecFunctionType(const TypeSignature &Sig) {
+  s::vector<llvm::Type *> Params;
+  for (NumKind P : Sig.Params)
+    Params.push_back(TypeOf(*TheContext, P));
+  return llvm::FunctionType::get(TypeOf(*TheContext, Sig.Ret), Params, false);
+}
+
+/// getSpecFunction - Find or declare the specialized clone of Name.
+static llvm::Function *getSpecFunction(const s::string &Name, const TypeSignature &Sig) {
+  if (llvm::Function *F = TheModule->getFunction(Name + ".spec"))
+    return F;
+  return llvm::Function::Create(SpecFunctionType(Sig), llvm::Function::ExternalLinkage,
+                                Name + ".spec", TheModule.get());
+}
+
+//===----------------------------------------------------------------------===//
+// Debug Information
+//===----------------------------------------------------------------------===//
+
+// Debug info builder of TheModule, when Options.DebugInfo is on.
+static s::unique_ptr<llvm::DIBuilder> DBuilder;
+static llvm::DICompileUnit *TheCU = nullptr;
+// Subprogram of the function being generated, if it has one.
+static llvm::DISubprogram *CurSubprogram = nullptr;
+
+/// DebugType - The debug info type of the value type Ty.
+static llvm::DIType *DebugType(llvm::Type *Ty) {
+  switch (KindOf(Ty)) {
+  case NK_Int:
+    return DBuilder->createBasicType("int", 64, llvm::dwarf::DW_ATE_signed);
+  case NK_Float:
+    return DBuilder->createBasicType("float", 32, llvm::dwarf::DW_ATE_float);
+  default:
+    return DBuilder->createBasicType("double", 64, llvm::dwarf::DW_ATE_float);
+  }
+}
+
+/// BeginDebugFunction - Describe F, whose body Builder is about to emit from
+/// the definition Proto, and point the builder at its first line.
+static void BeginDebugFunction(llvm::Function &F, const PrototypeAST &Proto) {
+  if (not DBuilder)
+    return;
+
+  llvm::DIFile *Unit = TheCU->getFile();
+  s::vector<llvm::Metadata *> Types{DebugType(F.getReturnType())};
+  for (auto &Arg : F.args())
+    Types.push_back(DebugType(Arg.getType()));
+  llvm::DISubprogram *SP = DBuilder->createFunction(
+      Unit, Proto.getName(), F.getName(), Unit, Proto.Line,
+      DBuilder->createSubroutineType(DBuilder->getOrCreateTypeArray(Types)),
+      Proto.Line, llvm::DINode::FlagPrototyped, llvm::DISubprogram::SPFlagDefinition);
+  F.setSubprogram(SP);
+  CurSubprogram = SP;
+
+  llvm::DebugLoc Loc = llvm::DILocation::get(*TheContext, Proto.Line, 0, SP);
+  Builder->SetCurrentDebugLocation(Loc);
+
+  // Let debuggers show the arguments.
+  unsigned ArgNo = 0;
+  for (auto &Arg : F.args()) {
+    llvm::DILocalVariable *Var = DBuilder->createParameterVariable(
+        SP, Proto.Args[ArgNo], ArgNo + 1, Unit, Proto.Line, DebugType(Arg.getType()), true);
+    ++ArgNo;
+    DBuilder->insertDbgValueIntrinsic(&Arg, Var, DBuilder->createExpression(), Loc,
+                                      Builder->GetInsertBlock());
+  }
+}
+
+/// EndDebugFunction - Done with the function started by BeginDebugFunction.
+static void EndDebugFunction() {
+  if (CurSubprogram)
+    DBuilder->finalizeSubprogram(CurSubprogram);
+  CurSubprogram = nullptr;
+  Builder->SetCurrentDebugLocation(llvm::DebugLoc());
+}
+
+/// EmitLocation - Attribute the instructions emitted next to E.
+static void EmitLocation(const ExprAST &E) {
+  if (CurSubprogram)
+    Builder->SetCurrentDebugLocation(
+        llvm::DILocation::get(*TheContext, E.Loc.Line, E.Loc.Col, CurSubprogram));
+}
+
+void FinalizeDebugInfo() {
+  if (not DBuilder)
+    return;
+  DBuilder->finalize();
+  // The builder tracks metadata of TheContext, which the JIT may free.
+  DBuilder.reset();
+  TheCU = nullptr;
+}
+
+//===----------------------------------------------------------------------===//
+// Partial Evaluation
+//===----------------------------------------------------------------------===//
+
+static llvm::Value *EmitExpr(ExprAST &Root);
+
+// Copies of the definitions compiled so far (with Options.PartialEval), so
+// their bodies can be emitted again for constant arguments.
+static s::map<s::string, s::unique_ptr<FunctionAST>> DefinitionASTs;
+
+/// PartialValue - A call to a definition with some constant arguments:
+/// either folded to Value, or calling Clone with the remaining arguments.
+struct PartialValue {
+  llvm::Function *Clone = nullptr;
+  llvm::Constant *Value = nullptr;
+};
+
+// Specializations in the current module, by callee and then by the pattern
+// of constant arguments.  Budget is what is left of
+// Options.SpecializeBudget for the module, in AST nodes.
+static s::map<s::string, s::map<s::string, PartialValue>> Specializations;
+static unsigned SpecializeBudget = 0;
+static unsigned SpecializeDepth = 0;
+
+// Limit on specializations emitted while emitting another, which bounds the
+// native stack used for recursive definitions.
+static const unsigned MaxSpecializeDepth = 16;
+
+/// RememberDefinition - Keep a copy of F for later specialization, replacing
+/// the clones of an earlier version.
+static void RememberDefinition(const FunctionAST &F) {
+  const s::string &Name = F.Proto->getName();
+  if (not Options.PartialEval or Name.compare(0, 11, "__anon_expr") == 0)
+    return;
+  DefinitionASTs[Name] = CloneFunction(F);
+  Specializations.erase(Name);
+}
+
+/// GetConstant - The value of V if it is a numeric constant.
+static bool GetConstant(llvm::Value *V, double &Out) {
+  if (auto *C = llvm::dyn_cast<llvm::ConstantFP>(V)) {
+    llvm::APFloat F = C->getValueAPF();
+    bool LosesInfo;
+    F.convert(llvm::APFloat::IEEEdouble(), llvm::APFloat::rmNearestTiesToEven, &LosesInfo);
+    Out = F.convertToDouble();
+    return true;
+  }
+  if (auto *C = llvm::dyn_cast<llvm::ConstantInt>(V)) {
+    Out = static_cast<double>(C->getSExtValue());
+    return true;
+  }
+  return false;
+}
+
+/// EmitPartialClone - Emit the body of F into Clone, with the parameters
+/// that have a constant in Consts replaced by it.  The state of the function
+/// being emitted is put aside meanwhile.  Returns the value returned, or
+/// nullptr on error.
+static llvm::Value *EmitPartialClone(llvm::Function *Clone, const FunctionAST &F,
+                                     const s::vector<llvm::Constant *> &Consts) {
+  llvm::IRBuilderBase::InsertPoint IP = Builder->saveIP();
+  llvm::DebugLoc Loc = Builder->getCurrentDebugLocation();
+  llvm::FastMathFlags FMF = Builder->getFastMathFlags();
+  auto SavedNamed = s::move(NamedValues);
+  auto SavedShared = s::move(SharedValues);
+  auto SavedReused = s::move(ReusedValues);
+  const CodegenOptions *SavedOptions = CurOptions;
+  bool SavedTyped = TypedMode;
+  llvm::DISubprogram *SavedSubprogram = CurSubprogram;
+
+  NamedValues.clear();
+  SharedValues.clear();
+  ReusedValues.clear();
+  TypedMode = false;
+  CurSubprogram = nullptr; // clones carry no debug info
+  Builder->SetCurrentDebugLocation(llvm::DebugLoc());
+  Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", Clone));
+  ApplyFunctionOptions(*Clone, GetFunctionOptions(F.Proto->getName()));
+
+  auto Arg = Clone->arg_begin();
+  for (unsigned i = 0, e = Consts.size(); i != e; ++i) {
+    if (Consts[i]) {
+      NamedValues[F.Proto->Args[i]] = Consts[i];
+    } else {
+      Arg->setName(F.Proto->Args[i]);
+      NamedValues[F.Proto->Args[i]] = &*Arg++;
+    }
+  }
+
+  ++SpecializeDepth;
+  llvm::Value *RetVal = EmitExpr(*F.Body);
+  --SpecializeDepth;
+  if (RetVal)
+    Builder->CreateRet(RetVal);
+
+  NamedValues = s::move(SavedNamed);
+  SharedValues = s::move(SavedShared);
+  ReusedValues = s::move(SavedReused);
+  CurOptions = SavedOptions;
+  TypedMode = SavedTyped;
+  CurSubprogram = SavedSubprogram;
+  Builder->restoreIP(IP);
+  Builder->SetCurrentDebugLocation(Loc);
+  Builder->setFastMathFlags(FMF);
+  return RetVal;
+}
+
+/// EmitPartialCall - Emit a call to the definition Callee where some of
+/// ArgsV are constants, by calling a clone of Callee specialized to them.  A
+/// clone that reduces to a constant (every argument constant, and every call
+/// in the body folded in turn) is dropped and the call folded to that
+/// constant.  Returns nullptr if Callee is not specialized.
+static llvm::Value *EmitPartialCall(const s::string &Callee,
+                                    const s::vector<llvm::Value *> &ArgsV) {
+  auto DI = DefinitionASTs.find(Callee);
+  if (DI == DefinitionASTs.end() or DI->second->Proto->Args.size() != ArgsV.size())
+    return nullptr;
+
+  s::string Key;
+  s::vector<llvm::Constant *> Consts;
+  s::vector<llvm::Value *> Rest;
+  for (llvm::Value *V : ArgsV) {
+    double Val;
+    if (GetConstant(V, Val)) {
+      uint64_t Bits;
+      memcpy(&Bits, &Val, sizeof(Bits));
+      Key += s::to_string(Bits);
+      Consts.push_back(llvm::ConstantFP::get(*TheContext, llvm::APFloat(Val)));
+    } else {
+      Key += '_';
+      Consts.push_back(nullptr);
+      Rest.push_back(ConvertKind(V, NK_Double));
+    }
+    Key += ',';
+  }
+  if (Rest.size() == ArgsV.size())
+    return nullptr;
+
+  auto &Clones = Specializations[Callee];
+  auto It = Clones.find(Key);
+  if (It == Clones.end()) {
+    const FunctionAST &F = *DI->second;
+    unsigned Size = 0;
+    PostOrder(Size, *F.Body, [](unsigned &Out, ExprAST &, unsigned *Ops, unsigned N) {
+      Out = 1;
+      for (unsigned i = 0; i != N; ++i)
+        Out += Ops[i];
+      return true;
+    });
+    if (SpecializeDepth == MaxSpecializeDepth or Size > SpecializeBudget)
+      return nullptr;
+    SpecializeBudget -= Size;
+
+    s::vector<llvm::Type *> Doubles(Rest.size(), llvm::Type::getDoubleTy(*TheContext));
+    llvm::FunctionType *FT =
+        llvm::FunctionType::get(llvm::Type::getDoubleTy(*TheContext), Doubles, false);
+    llvm::Function *Clone =
+        llvm::Function::Create(FT, llvm::Function::InternalLinkage,
+                               Callee + ".pe" + s::to_string(Clones.size()), TheModule.get());
+    // Entered before the body is emitted, so that recursive calls with the
+    // same constants call the clone.
+    It = Clones.emplace(Key, PartialValue{Clone, nullptr}).first;
+
+    llvm::Value *RetVal = EmitPartialClone(Clone, F, Consts);
+    if (not RetVal) {
+      Clones.erase(It);
+      Clone->eraseFromParent();
+      return nullptr;
+    }
+    if (Options.Verify)
+      verifyFunction(*Clone, &llvm::errs());
+    if (auto *C = llvm::dyn_cast<llvm::Constant>(RetVal)) {
+      It->second.Value = C;
+      if (Clone->use_empty()) {
+        Clone->eraseFromParent();
+        It->second.Clone = nullptr;
+      }
+    }
+  }
+
+  if (It->second.Value)
+    return It->second.Value;
+  return Builder->CreateCall(It->second.Clone, Rest, "calltmp");
+}
+
+//===----------------------------------------------------------------------===//
+// AST Code Generation
+//===----------------------------------------------------------------------===//
+
 void InitializeModule() {
-  // Open a new context and module.
+  DBuilder.reset();
+
+  // Open a new context and module, freeing an unused module of the previous
+  // context before the context itself.
+  Builder.reset();
+  TheModule.reset();
   TheContext = s::make_unique<llvm::LLVMContext>();
   TheModule = s::make_unique<llvm::Module>("my cool jit", *TheContext);
+  TheContext->setDiscardValueNames(Options.DiscardValueNames);
 
   // Create a new builder for the module.
   Builder = s::make_unique<llvm::IRBuilder<>>(*TheContext);
+
+  Specializations.clear();
+  SpecializeBudget = Options.SpecializeBudget;
+
+  if (Options.DebugInfo) {
+    TheModule->addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                             llvm::DEBUG_METADATA_VERSION);
+    TheModule->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+    DBuilder = s::make_unique<llvm::DIBuilder>(*TheModule);
+    TheCU = DBuilder->createCompileUnit(llvm::dwarf::DW_LANG_C,
+                                        DBuilder->createFile(Options.SourceFile, "."),
+                                        "Kaleidoscope Compiler", false, "", 0);
+  }
 }
 
 llvm::Value *NumberExprCodegen::codegen() {
+  if (TypedMode) {
+    switch (LiteralKind(Val, CurOptions->RelaxedFloat)) {
+    case NK_Int:
+      return llvm::ConstantInt::get(llvm::Type::getInt64Ty(*TheContext),
+                                    static_cast<int64_t>(Val), true);
+    case NK_Float:
+      return llvm::ConstantFP::get(llvm::Type::getFloatTy(*TheContext), Val);
+    default:
+      break;
+    }
+  }
   return llvm::ConstantFP::get(*TheContext, llvm::APFloat(Val));
 }
 
@@ -52,11 +592,27 @@ llvm::Value *VariableExprCodegen::codegen() {
   return V;
 }
 
-llvm::Value *BinaryExprCodegen::codegen() {
-  llvm::Value *L = LHS->codegen();
-  llvm::Value *R = RHS->codegen();
-  if (not L or not R)
-    return nullptr;
+/// EmitBinary - Emit L Op R for operands that are already emitted.
+static llvm::Value *EmitBinary(char Op, llvm::Value *L, llvm::Value *R) {
+  if (TypedMode) {
+    // Integers whose result may leave the exact range are added, subtracted
+    // or multiplied as doubles, as the generic body would.
+    NumKind K = JoinKind(KindOf(L->getType()), KindOf(R->getType()));
+    double Bound = K == NK_Int ? BinaryBound(Op, BoundOf(L), BoundOf(R)) : 0;
+    if (K == NK_Int and BinaryKind(Op, K, K, Bound) != NK_Int)
+      K = NK_Double;
+    L = ConvertKind(L, K);
+    R = ConvertKind(R, K);
+    if (K == NK_Int)
+      return SetBound(EmitIntBinOp(Op, L, R), Bound);
+  }
+
+  if (CurOptions->Contract == FPC_On and (Op == '+' or Op == '-')) {
+    if (llvm::Value *V = FuseMulAdd(L, R, false, Op == '-'))
+      return V;
+    if (llvm::Value *V = FuseMulAdd(R, L, Op == '-', false))
+      return V;
+  }
 
   switch (Op) {
   case '+':
@@ -67,6 +623,9 @@ llvm::Value *BinaryExprCodegen::codegen() {
     return Builder->CreateFMul(L, R, "multmp");
   case '<':
     L = Builder->CreateFCmpULT(L, R, "cmptmp");
+    if (TypedMode)
+      return SetBound(Builder->CreateZExt(L, llvm::Type::getInt64Ty(*TheContext), "booltmp"),
+                      1);
     // Convert bool 0/1 to double 0.0 or 1.0
     return Builder->CreateUIToFP(L, llvm::Type::getDoubleTy(*TheContext), "booltmp");
   default:
@@ -74,26 +633,110 @@ llvm::Value *BinaryExprCodegen::codegen() {
   }
 }
 
-llvm::Value *CallExprCodegen::codegen() {
+/// EmitCall - Emit a call to Callee with arguments that are already emitted.
+static llvm::Value *EmitCall(const s::string &Callee, s::vector<llvm::Value *> ArgsV) {
   // Look up the name in the global module table.
-  llvm::Function *CalleeF = TheModule->getFunction(Callee);
+  llvm::Function *CalleeF = getFunction(Callee);
   if (not CalleeF)
     return LogErrorV("Unknown function referenced");
 
   // If argument mismatch error.
-  if (CalleeF->arg_size() != Args.size())
+  if (CalleeF->arg_size() != ArgsV.size())
     return LogErrorV("Incorrect # arguments passed");
 
-  s::vector<llvm::Value *> ArgsV;
-  for (unsigned i = 0, e = Args.size(); i != e; ++i) {
-    ArgsV.push_back(Args[i]->codegen());
-    if (not ArgsV.back())
-      return nullptr;
+  // Standard math externs become intrinsics, which LLVM can fold and
+  // vectorize.  Other externs, host functions and user definitions stay
+  // plain calls.
+  if (CalleeF->isDeclaration() and not DefinedNames.count(Callee)) {
+    const Builtin *B = FindBuiltin(Callee);
+    if (B and B->Arity == ArgsV.size() and B->ID != llvm::Intrinsic::not_intrinsic)
+      return EmitIntrinsicCall(B->ID, ArgsV);
+  }
+
+  if (Options.PartialEval)
+    if (llvm::Value *V = EmitPartialCall(Callee, ArgsV))
+      return V;
+
+  if (TypedMode) {
+    s::vector<NumKind> ArgKinds;
+    s::vector<double> ArgBounds;
+    for (llvm::Value *V : ArgsV) {
+      ArgKinds.push_back(KindOf(V->getType()));
+      ArgBounds.push_back(ArgKinds.back() == NK_Int ? BoundOf(V) : 0);
+    }
+
+    // Call the specialized clone directly when no argument needs narrowing
+    // or may be out of its range, otherwise go through the guarded double ABI.
+    auto It = Signatures.find(Callee);
+    if (It != Signatures.end() and It->second.accepts(ArgKinds, ArgBounds)) {
+      for (unsigned i = 0, e = ArgsV.size(); i != e; ++i)
+        ArgsV[i] = ConvertKind(ArgsV[i], It->second.Params[i]);
+      return SetBound(
+          Builder->CreateCall(getSpecFunction(Callee, It->second), ArgsV, "calltmp"),
+          It->second.RetBound);
+    }
+    for (auto &V : ArgsV)
+      V = ConvertKind(V, NK_Double);
   }
 
-  return Builder->CreateCall(CalleeF, ArgsV, "calltmp");
+  llvm::CallInst *Call = Builder->CreateCall(CalleeF, ArgsV, "calltmp");
+  // Nor may LLVM fold a host function or a definition as the library
+  // function it is named after.
+  if (HostNames.count(Callee) or DefinedNames.count(Callee) or not CalleeF->isDeclaration())
+    Call->addFnAttr(llvm::Attribute::NoBuiltin);
+  return Call;
 }
 
+/// EmitExpr - Emit the tree rooted at Root bottom up with an explicit stack,
+/// so that deeply nested expressions cannot overflow the native stack.
+static llvm::Value *EmitExpr(ExprAST &Root) {
+  // A shared subtree is emitted on its first reference and reused after.
+  auto Known = [](llvm::Value *&Out, ExprAST &E) {
+    if (E.Kind != EK_Shared)
+      return false;
+    auto It = SharedValues.find(static_cast<SharedExprAST &>(E).Target);
+    if (It == SharedValues.end())
+      return false;
+    Out = It->second;
+    return true;
+  };
+
+  llvm::Value *Result = nullptr;
+  bool Ok = PostOrder(Result, Root, Known,
+                      [](llvm::Value *&Out, ExprAST &E, llvm::Value **Ops, unsigned N) {
+    EmitLocation(E);
+    switch (E.Kind) {
+    case EK_Shared: {
+      SharedNode *Target = static_cast<SharedExprAST &>(E).Target;
+      Out = Ops[0];
+      if (Target->Uses > 1) {
+        SharedValues[Target] = Out;
+        ReusedValues.insert(Out);
+      }
+      break;
+    }
+    case EK_Binary:
+      Out = EmitBinary(static_cast<BinaryExprAST &>(E).Op, Ops[0], Ops[1]);
+      break;
+    case EK_Call:
+      Out = EmitCall(static_cast<CallExprAST &>(E).Callee,
+                     s::vector<llvm::Value *>(Ops, Ops + N));
+      break;
+    default:
+      Out = E.codegen();
+      break;
+    }
+    return Out != nullptr;
+  });
+  return Ok ? Result : nullptr;
+}
+
+llvm::Value *BinaryExprCodegen::codegen() { return EmitExpr(*this); }
+
+llvm::Value *CallExprCodegen::codegen() { return EmitExpr(*this); }
+
+llvm::Value *SharedExprCodegen::codegen() { return EmitExpr(*this); }
+
 llvm::Function *PrototypeCodegen::codegen() {
   // Make the function type:  double(double,double) etc.
   s::vector<llvm::Type *> Doubles(Args.size(), llvm::Type::getDoubleTy(*TheContext));
@@ -103,6 +746,11 @@ llvm::Function *PrototypeCodegen::codegen() {
   llvm::Function *F =
       llvm::Function::Create(FT, llvm::Function::ExternalLinkage, Name, TheModule.get());
 
+  // Remember the first prototype seen for Name, so later modules can
+  // redeclare it.
+  if (not FunctionProtos.count(Name))
+    FunctionProtos[Name] = CreatePrototypeCodegen(Name, Args);
+
   // Set names for all arguments.
   unsigned Idx = 0;
   for (auto &Arg : F->args())
@@ -111,37 +759,188 @@ llvm::Function *PrototypeCodegen::codegen() {
   return F;
 }
 
-llvm::Function *FunctionCodegen::codegen() {
-  // First, check for an existing function from a previous 'extern' declaration.
-  llvm::Function *TheFunction = TheModule->getFunction(Proto->getName());
+/// EmitSpecialization - Emit the clone of F that computes in the kinds of Sig.
+static llvm::Function *EmitSpecialization(FunctionAST &F, const TypeSignature &Sig,
+                                          const CodegenOptions &O) {
+  llvm::Function *SpecF =
+      llvm::Function::Create(SpecFunctionType(Sig), llvm::Function::ExternalLinkage,
+                             F.Proto->getName() + ".spec", TheModule.get());
 
-  if (not TheFunction)
-    TheFunction = Proto->codegen();
+  llvm::BasicBlock *BB = llvm::BasicBlock::Create(*TheContext, "entry", SpecF);
+  Builder->SetInsertPoint(BB);
+  ApplyFunctionOptions(*SpecF, O);
+
+  NamedValues.clear();
+  SharedValues.clear();
+  ReusedValues.clear();
+  IntBounds.clear();
+  unsigned Idx = 0;
+  for (auto &Arg : SpecF->args()) {
+    Arg.setName(F.Proto->Args[Idx]);
+    NamedValues.emplace(F.Proto->Args[Idx++], SetBound(&Arg, Sig.ParamBound));
+  }
+  BeginDebugFunction(*SpecF, *F.Proto);
+
+  TypedMode = true;
+  llvm::Value *RetVal = F.Body->codegen();
+  TypedMode = false;
+  if (not RetVal) {
+    EndDebugFunction();
+    SpecF->eraseFromParent();
+    return nullptr;
+  }
+
+  Builder->CreateRet(ConvertKind(RetVal, Sig.Ret));
+  EndDebugFunction();
+  if (Options.Verify)
+    verifyFunction(*SpecF, &llvm::errs());
+  return SpecF;
+}
+
+/// EmitGuardedCall - In the double ABI function Wrapper, call SpecF when every
+/// argument is representable in its inferred kind.  Returns false when the
+/// call is unconditional, otherwise leaves Builder in the block taken when
+/// the guard fails.
+static bool EmitGuardedCall(llvm::Function *Wrapper, llvm::Function *SpecF,
+                            const TypeSignature &Sig) {
+  llvm::Type *DoubleTy = llvm::Type::getDoubleTy(*TheContext);
+  llvm::Value *MaxInt = llvm::ConstantFP::get(DoubleTy, Sig.ParamBound);
+  llvm::Value *MinInt = llvm::ConstantFP::get(DoubleTy, -Sig.ParamBound);
+
+  llvm::Value *Ok = nullptr;
+  s::vector<llvm::Value *> SpecArgs;
+  unsigned Idx = 0;
+  for (auto &Arg : Wrapper->args()) {
+    NumKind P = Sig.Params[Idx++];
+    llvm::Value *Narrow = &Arg;
+    llvm::Value *Back = nullptr;
+    switch (P) {
+    case NK_Int: {
+      // Only values in the clone's range may take it.  Clamp first: fptosi
+      // of an out of range value is poison.
+      llvm::Value *InRange = Builder->CreateAnd(Builder->CreateFCmpOGE(&Arg, MinInt),
+                                                Builder->CreateFCmpOLE(&Arg, MaxInt));
+      llvm::Value *Safe = Builder->CreateSelect(
+          InRange, &Arg, llvm::ConstantFP::get(DoubleTy, 0.0));
+      Narrow = Builder->CreateFPToSI(Safe, llvm::Type::getInt64Ty(*TheContext),
+                                     "convtmp");
+      Back = Builder->CreateSIToFP(Narrow, DoubleTy);
+      break;
+    }
+    case NK_Float:
+      Narrow = Builder->CreateFPTrunc(&Arg, llvm::Type::getFloatTy(*TheContext),
+                                      "convtmp");
+      Back = Builder->CreateFPExt(Narrow, DoubleTy);
+      break;
+    default:
+      break;
+    }
+    SpecArgs.push_back(Narrow);
+    if (Back) {
+      llvm::Value *Exact = Builder->CreateFCmpOEQ(Back, &Arg, "exacttmp");
+      Ok = Ok ? Builder->CreateAnd(Ok, Exact, "guardtmp") : Exact;
+    }
+  }
+
+  llvm::BasicBlock *SpecBB = nullptr;
+  llvm::BasicBlock *GenericBB = nullptr;
+  if (Ok) {
+    SpecBB = llvm::BasicBlock::Create(*TheContext, "spec", Wrapper);
+    GenericBB = llvm::BasicBlock::Create(*TheContext, "generic", Wrapper);
+    Builder->CreateCondBr(Ok, SpecBB, GenericBB);
+    Builder->SetInsertPoint(SpecBB);
+  }
+
+  llvm::Value *RetVal = Builder->CreateCall(SpecF, SpecArgs, "calltmp");
+  Builder->CreateRet(ConvertKind(RetVal, NK_Double));
+
+  if (not Ok)
+    return false;
+  Builder->SetInsertPoint(GenericBB);
+  return true;
+}
+
+llvm::Function *FunctionCodegen::codegen() {
+  // Record this prototype, replacing a previous 'extern' declaration, and
+  // declare the function in the current module.
+  FunctionProtos[Proto->getName()] = CreatePrototypeCodegen(Proto->getName(), Proto->Args);
+  llvm::Function *TheFunction = getFunction(Proto->getName());
 
   if (not TheFunction)
     return nullptr;
 
+  // With type inference on, emit the specialized clone first so the generic
+  // body and later callers can refer to it.
+  const CodegenOptions &O = GetFunctionOptions(Proto->getName());
+  llvm::Function *SpecF = nullptr;
+  bool TypedBody = false;
+  Signatures.erase(Proto->getName()); // from an earlier version
+  if (O.InferTypes) {
+    TypeSignature Sig = InferSignature(*this, O.RelaxedFloat);
+    if (Proto->Args.empty()) {
+      // Nothing to guard: compute in the inferred kinds right in the body.
+      TypedBody = true;
+    } else if (not Sig.isGeneric()) {
+      Signatures[Proto->getName()] = Sig;
+      SpecF = EmitSpecialization(*this, Sig, O);
+      if (not SpecF) {
+        Signatures.erase(Proto->getName());
+        TheFunction->eraseFromParent();
+        return nullptr;
+      }
+    }
+  }
+
   // Create a new basic block to start insertion into.
   llvm::BasicBlock *BB = llvm::BasicBlock::Create(*TheContext, "entry", TheFunction);
   Builder->SetInsertPoint(BB);
+  ApplyFunctionOptions(*TheFunction, O);
+  BeginDebugFunction(*TheFunction, *Proto);
+
+  if (SpecF and not EmitGuardedCall(TheFunction, SpecF, Signatures[Proto->getName()])) {
+    // The clone takes every input, no generic body is needed.
+    EndDebugFunction();
+    if (Options.Verify)
+      verifyFunction(*TheFunction, &llvm::errs());
+    DefinedNames.insert(Proto->getName());
+    RememberDefinition(*this);
+    return TheFunction;
+  }
 
   // Record the function arguments in the NamedValues map.
   NamedValues.clear();
+  SharedValues.clear();
+  ReusedValues.clear();
+  IntBounds.clear();
+  // By the prototype's names, as the context may discard value names.
+  unsigned Idx = 0;
   for (auto &Arg : TheFunction->args())
-    NamedValues[s::string(Arg.getName())] = &Arg;
+    NamedValues.emplace(Proto->Args[Idx++], &Arg);
 
-  if (llvm::Value *RetVal = Body->codegen()) {
+  TypedMode = TypedBody;
+  llvm::Value *RetVal = Body->codegen();
+  TypedMode = false;
+  if (RetVal)
     // Finish off the function.
-    Builder->CreateRet(RetVal);
+    Builder->CreateRet(TypedBody ? ConvertKind(RetVal, NK_Double) : RetVal);
+  EndDebugFunction();
 
+  if (RetVal) {
     // Validate the generated code, checking for consistency.
-    verifyFunction(*TheFunction);
+    if (Options.Verify)
+      verifyFunction(*TheFunction, &llvm::errs());
 
+    DefinedNames.insert(Proto->getName());
+    RememberDefinition(*this);
     return TheFunction;
   }
 
   // Error reading body, remove function.
   TheFunction->eraseFromParent();
+  if (SpecF) {
+    Signatures.erase(Proto->getName());
+    SpecF->eraseFromParent();
+  }
   return nullptr;
 }
 
@@ -174,5 +973,15 @@ s::unique_ptr<FunctionAST> CreateFunctionCodegen(s::unique_ptr<PrototypeAST> Pro
   return s::make_unique<FunctionCodegen>(s::move(Proto), s::move(Body));
 }
 
+s::unique_ptr<ExprAST> CreateSharedExprCodegen(SharedNode *Target) {
+  return s::make_unique<SharedExprCodegen>(Target);
+}
+
+const ASTFactory CodegenFactory = {
+    CreateNumberExprCodegen, CreateVariableExprCodegen, CreateBinaryExprCodegen,
+    CreateCallExprCodegen,   CreatePrototypeCodegen,    CreateFunctionCodegen,
+    CreateSharedExprCodegen,
+};
+
 } // namespace k
 } // namespace llvmpg
\ No newline at end of file
@@ -7,8 +7,10 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Function.h>
+#include <llvm/IR/Operator.h>
 #include <memory>
 #include <map>
+#include <set>
 #include <string>
 
 namespace llvmpg {
@@ -25,9 +27,93 @@ extern s::unique_ptr<llvm::Module> TheModule;
 extern s::unique_ptr<llvm::IRBuilder<>> Builder;
 extern s::map<s::string, llvm::Value *> NamedValues;
 
+/// FunctionProtos - The prototype of every function defined or declared so
+/// far, so that functions living in earlier modules can be redeclared in the
+/// current one.
+extern s::map<s::string, s::unique_ptr<PrototypeAST>> FunctionProtos;
+
+/// DefinedNames - Names of the functions given a body so far, in any module.
+/// A definition shadows the math builtin of the same name.
+extern s::set<s::string> DefinedNames;
+
 llvm::Value *LogErrorV(const char *Str);
 void InitializeModule();
 
+/// FinalizeDebugInfo - Complete the debug info of TheModule (see
+/// CodegenOptions::DebugInfo).  Call once the module is fully generated and
+/// before it is optimized, printed or handed to the JIT.
+void FinalizeDebugInfo();
+
+/// getFunction - Find Name in the current module, or declare it there from
+/// FunctionProtos.  Returns nullptr if the function is unknown.
+llvm::Function *getFunction(const s::string &Name);
+
+//===----------------------------------------------------------------------===//
+// Code Generation Options
+//===----------------------------------------------------------------------===//
+
+/// FPContract - How floating point multiply and add may be fused, mirroring
+/// clang's -ffp-contract.  Off keeps separate fmul/fadd, On fuses a*b+c inside
+/// one expression into llvm.fmuladd, Fast lets the backend fuse anywhere.
+enum FPContract : int {
+  FPC_Off = 0,
+  FPC_On = 1,
+  FPC_Fast = 2,
+};
+
+/// VectorLibrary - Vector math library whose entry points vectorized math
+/// calls may use.
+enum VectorLibrary : int {
+  VL_None = 0,
+  VL_LIBMVEC = 1,
+  VL_SVML = 2,
+  VL_Accelerate = 3,
+  VL_MASSV = 4,
+};
+
+/// CodegenOptions - Numeric code generation settings.  The default is strict
+/// IEEE arithmetic for the generic target.
+struct CodegenOptions {
+  llvm::FastMathFlags FastMath; // flags set on every FP instruction
+  FPContract Contract = FPC_Off;
+  s::string TargetCPU;          // "native" selects the host CPU
+  s::string TargetFeatures;     // e.g. "+avx2,+fma"; filled in for "native"
+  bool InferTypes = false;      // emit i64/float clones where types allow
+  bool RelaxedFloat = false;    // let inference narrow to float arithmetic
+  VectorLibrary VecLib = VL_None; // session wide, used by the optimizer
+  bool DebugInfo = false;       // session wide: DWARF line tables and subprograms
+  s::string SourceFile = "<stdin>"; // file name recorded in the debug info
+  // Session wide: calls to a definition with constant arguments call a clone
+  // specialized to them, or fold to a literal when the clone computes one.
+  // Each module may clone up to SpecializeBudget AST nodes.
+  bool PartialEval = false;
+  unsigned SpecializeBudget = 2000;
+  // Session wide diagnostics, which cost about as much as codegen itself:
+  // the IR verifier on every function, and names on IR values.
+  bool Verify = true;
+  bool DiscardValueNames = false;
+};
+
+/// Options - The per-session options, used for every function unless
+/// FunctionOptions has an entry for it.
+extern CodegenOptions Options;
+extern s::map<s::string, CodegenOptions> FunctionOptions;
+
+/// GetFunctionOptions - Options in effect for the function called Name.
+const CodegenOptions &GetFunctionOptions(const s::string &Name);
+
+/// ParseFastMathFlags - Parse a comma separated list such as
+/// "reassoc,contract,nnan" (or "fast") into FMF.  Returns false on an unknown
+/// flag.
+bool ParseFastMathFlags(llvm::FastMathFlags &FMF, const s::string &Spec);
+
+/// ResolveTargetCPU - Replace a "native" CPU in O with the host CPU name and
+/// its feature string.
+void ResolveTargetCPU(CodegenOptions &O);
+
+/// ApplyFunctionOptions - Set up Builder and the attributes of F for O.
+void ApplyFunctionOptions(llvm::Function &F, const CodegenOptions &O);
+
 //===----------------------------------------------------------------------===//
 // Codegen AST Extensions
 //===----------------------------------------------------------------------===//
@@ -60,6 +146,12 @@ struct CallExprCodegen : public CallExprAST {
   llvm::Value *codegen() override;
 };
 
+/// SharedExprAST - Expression class for a reference to an interned subtree.
+struct SharedExprCodegen : public SharedExprAST {
+  SharedExprCodegen(SharedNode *Target) : SharedExprAST(Target) {}
+  llvm::Value *codegen() override;
+};
+
 /// PrototypeAST - This class represents the "prototype" for a function,
 /// which captures its name, and its argument names (thus implicitly the number
 /// of arguments the function takes).
@@ -88,6 +180,11 @@ s::unique_ptr<PrototypeAST> CreatePrototypeCodegen(const s::string &Name,
                                                    s::vector<s::string> Args);
 s::unique_ptr<FunctionAST> CreateFunctionCodegen(s::unique_ptr<PrototypeAST> Proto,
                                                  s::unique_ptr<ExprAST> Body);
+s::unique_ptr<ExprAST> CreateSharedExprCodegen(SharedNode *Target);
+
+/// CodegenFactory - Makes the parser build codegen nodes when assigned to
+/// Factory.
+extern const ASTFactory CodegenFactory;
 
 } // namespace k
 } // namespace llvmpg
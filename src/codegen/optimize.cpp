@@ -0,0 +1,188 @@
+#include <codegen/optimize.h>
+#include <codegen/builtins.h>
+#include <codegen/codegen.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/IR/Attributes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/Host.h>
+#include <set>
+
+namespace llvmpg {
+namespace k {
+
+namespace s = std;
+
+//===----------------------------------------------------------------------===//
+// Interprocedural Analysis and Optimization
+//===----------------------------------------------------------------------===//
+
+s::map<s::string, FunctionEffects> KnownEffects;
+
+bool IsPureExtern(const s::string &Name, unsigned Arity) {
+  const Builtin *B = FindBuiltin(Name);
+  return B and B->Arity == Arity;
+}
+
+/// SeedEffects - What is known about F before looking at any function body.
+static FunctionEffects SeedEffects(const llvm::Function &F) {
+  FunctionEffects E;
+  s::string Name = F.getName().str();
+  auto It = KnownEffects.find(Name);
+  if (F.isIntrinsic()) {
+    E.Pure = true;
+    E.WillReturn = true;
+  } else if (not F.isDeclaration()) {
+    // Optimistic for purity, pessimistic for termination: the fixed point
+    // then keeps recursive pure functions pure but never willreturn.
+    E.Pure = true;
+  } else if (It != KnownEffects.end()) {
+    E = It->second;
+  } else if (not DefinedNames.count(Name) and IsPureExtern(Name, F.arg_size())) {
+    // A definition shadows the builtin of the same name.
+    E.Pure = true;
+    E.WillReturn = true;
+  }
+  return E;
+}
+
+void InferFunctionAttrs(llvm::Module &M) {
+  s::map<const llvm::Function *, FunctionEffects> Effects;
+  for (llvm::Function &F : M)
+    Effects[&F] = SeedEffects(F);
+
+  // Purity only goes down and termination only goes up, so this converges.
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (llvm::Function &F : M) {
+      if (F.isDeclaration())
+        continue;
+
+      bool Pure = true;
+      bool WillReturn = true;
+      for (llvm::Instruction &I : llvm::instructions(F)) {
+        auto *Call = llvm::dyn_cast<llvm::CallBase>(&I);
+        if (not Call)
+          continue;
+        const llvm::Function *Callee = Call->getCalledFunction();
+        FunctionEffects CalleeE = Callee ? Effects[Callee] : FunctionEffects();
+        Pure = Pure and CalleeE.Pure;
+        WillReturn = WillReturn and CalleeE.WillReturn;
+      }
+
+      FunctionEffects &E = Effects[&F];
+      if (E.Pure and not Pure) {
+        E.Pure = false;
+        Changed = true;
+      }
+      if (not E.WillReturn and WillReturn) {
+        E.WillReturn = true;
+        Changed = true;
+      }
+    }
+  }
+
+  for (llvm::Function &F : M) {
+    if (F.isIntrinsic())
+      continue;
+    const FunctionEffects &E = Effects[&F];
+    if (not F.isDeclaration())
+      KnownEffects[F.getName().str()] = E;
+
+    if (E.Pure) {
+      F.setDoesNotAccessMemory();
+      F.setDoesNotThrow();
+      F.addFnAttr(llvm::Attribute::NoFree);
+      F.addFnAttr(llvm::Attribute::NoSync);
+    }
+    if (E.WillReturn) {
+      F.addFnAttr(llvm::Attribute::WillReturn);
+      if (not F.isDeclaration())
+        F.setDoesNotRecurse();
+    }
+    if (E.Pure and E.WillReturn)
+      F.addFnAttr(llvm::Attribute::Speculatable);
+  }
+}
+
+static llvm::OptimizationLevel GetOptimizationLevel(unsigned OptLevel) {
+  switch (OptLevel) {
+  case 0:
+    return llvm::OptimizationLevel::O0;
+  case 1:
+    return llvm::OptimizationLevel::O1;
+  case 2:
+    return llvm::OptimizationLevel::O2;
+  default:
+    return llvm::OptimizationLevel::O3;
+  }
+}
+
+static llvm::TargetLibraryInfoImpl::VectorLibrary GetVectorLibrary(VectorLibrary VL) {
+  switch (VL) {
+  case VL_LIBMVEC:
+    return llvm::TargetLibraryInfoImpl::LIBMVEC_X86;
+  case VL_SVML:
+    return llvm::TargetLibraryInfoImpl::SVML;
+  case VL_Accelerate:
+    return llvm::TargetLibraryInfoImpl::Accelerate;
+  case VL_MASSV:
+    return llvm::TargetLibraryInfoImpl::MASSV;
+  default:
+    return llvm::TargetLibraryInfoImpl::NoLibrary;
+  }
+}
+
+void OptimizeWholeProgram(llvm::Module &M, const s::vector<s::string> &Roots,
+                          unsigned OptLevel) {
+  InferFunctionAttrs(M);
+
+  // Nothing outside the module can call a non-root, which lets IPSCCP
+  // propagate constant arguments and GlobalDCE drop what is never reached.
+  s::set<s::string> Keep(Roots.begin(), Roots.end());
+  for (llvm::Function &F : M)
+    if (not F.isDeclaration() and not Keep.count(F.getName().str()))
+      F.setLinkage(llvm::GlobalValue::InternalLinkage);
+
+  OptimizeModule(M, OptLevel);
+}
+
+void OptimizeModule(llvm::Module &M, unsigned OptLevel) {
+  llvm::LoopAnalysisManager LAM;
+  llvm::FunctionAnalysisManager FAM;
+  llvm::CGSCCAnalysisManager CGAM;
+  llvm::ModuleAnalysisManager MAM;
+  llvm::PassBuilder PB;
+
+  // Library info comes first so the default registration does not replace
+  // it; with a vector math library the vectorizers may call its entry points
+  // for the math intrinsics.
+  s::string Triple = M.getTargetTriple();
+  llvm::TargetLibraryInfoImpl TLII(
+      llvm::Triple(Triple.empty() ? llvm::sys::getDefaultTargetTriple() : Triple));
+  TLII.addVectorizableFunctionsFromVecLib(GetVectorLibrary(Options.VecLib));
+  FAM.registerPass([&TLII] { return llvm::TargetLibraryAnalysis(TLII); });
+
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  llvm::OptimizationLevel Level = GetOptimizationLevel(OptLevel);
+  llvm::ModulePassManager MPM = Level == llvm::OptimizationLevel::O0
+                                    ? PB.buildO0DefaultPipeline(Level)
+                                    : PB.buildPerModuleDefaultPipeline(Level);
+  MPM.run(M, MAM);
+}
+
+} // namespace k
+} // namespace llvmpg
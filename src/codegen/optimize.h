@@ -0,0 +1,56 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class Module;
+}
+
+namespace llvmpg {
+namespace k {
+
+namespace s = std;
+
+//===----------------------------------------------------------------------===//
+// Interprocedural Analysis and Optimization
+//===----------------------------------------------------------------------===//
+
+/// FunctionEffects - What is known about the behavior of a function.
+struct FunctionEffects {
+  bool Pure = false;       // reads and writes no memory, has no side effects
+  bool WillReturn = false; // always returns (no unbounded recursion)
+};
+
+/// KnownEffects - Effects of the functions analyzed so far, by name, so that
+/// functions defined in earlier modules are still known when later modules
+/// only declare them.
+extern s::map<s::string, FunctionEffects> KnownEffects;
+
+/// IsPureExtern - Whether the extern Name taking Arity arguments is a known
+/// side effect free math function (see builtins.h).
+bool IsPureExtern(const s::string &Name, unsigned Arity);
+
+/// InferFunctionAttrs - Analyze the functions of M and attach what is proven:
+/// user definitions are pure unless they reach an unknown extern, and those
+/// that cannot recurse also always return.  Pure functions are marked
+/// readnone/nounwind, terminating ones willreturn/speculatable as well.
+void InferFunctionAttrs(llvm::Module &M);
+
+/// OptimizeModule - Run the per-module pipeline at OptLevel (0-3) on M,
+/// keeping every function visible.  Options.VecLib selects the vector math
+/// library the vectorizers may use.
+void OptimizeModule(llvm::Module &M, unsigned OptLevel);
+
+/// OptimizeWholeProgram - Treat M as the whole program: internalize every
+/// function except Roots, then run the interprocedural pipeline at OptLevel
+/// (inlining, IPSCCP, dead function elimination and function simplification).
+void OptimizeWholeProgram(llvm::Module &M, const s::vector<s::string> &Roots,
+                          unsigned OptLevel);
+
+} // namespace k
+} // namespace llvmpg
+
+#endif
@@ -0,0 +1,235 @@
+#include <codegen/typeinfer.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Type.h>
+#include <algorithm>
+#include <cmath>
+
+namespace llvmpg {
+namespace k {
+
+namespace s = std;
+
+//===----------------------------------------------------------------------===//
+// Type Inference
+//===----------------------------------------------------------------------===//
+
+s::map<s::string, TypeSignature> Signatures;
+
+bool TypeSignature::isGeneric() const {
+  if (Ret != NK_Double)
+    return false;
+  for (NumKind P : Params)
+    if (P != NK_Double)
+      return false;
+  return true;
+}
+
+bool TypeSignature::accepts(const s::vector<NumKind> &ArgKinds,
+                            const s::vector<double> &ArgBounds) const {
+  if (ArgKinds.size() != Params.size())
+    return false;
+  for (unsigned i = 0, e = Params.size(); i != e; ++i) {
+    if (ArgKinds[i] > Params[i])
+      return false;
+    if (ArgKinds[i] == NK_Int and Params[i] == NK_Int and ArgBounds[i] > ParamBound)
+      return false;
+  }
+  return true;
+}
+
+NumKind LiteralKind(double V, bool AllowFloat) {
+  if (V == s::trunc(V) and s::fabs(V) <= MaxExactInt)
+    return NK_Int;
+  if (AllowFloat and static_cast<double>(static_cast<float>(V)) == V)
+    return NK_Float;
+  return NK_Double;
+}
+
+double BinaryBound(char Op, double LBound, double RBound) {
+  switch (Op) {
+  case '<':
+    return 1;
+  case '*':
+    return LBound * RBound;
+  default:
+    return LBound + RBound;
+  }
+}
+
+NumKind BinaryKind(char Op, NumKind L, NumKind R, double Bound) {
+  if (Op == '<')
+    return NK_Int; // 0 or 1
+  NumKind K = JoinKind(L, R);
+  // The bound is computed in double, so a result just past 2^53 may round
+  // down to it: only a bound below 2^53 proves the result exact.
+  if (K == NK_Int and not (Bound < MaxExactInt))
+    return NK_Double;
+  return K;
+}
+
+NumKind CallKind(const s::string &Callee, const s::vector<NumKind> &ArgKinds,
+                 const s::vector<double> &ArgBounds, double &Bound) {
+  auto It = Signatures.find(Callee);
+  if (It == Signatures.end() or not It->second.accepts(ArgKinds, ArgBounds))
+    return NK_Double;
+  Bound = It->second.RetBound;
+  return It->second.Ret;
+}
+
+NumKind KindOf(llvm::Type *Ty) {
+  if (Ty->isIntegerTy())
+    return NK_Int;
+  if (Ty->isFloatTy())
+    return NK_Float;
+  return NK_Double;
+}
+
+llvm::Type *TypeOf(llvm::LLVMContext &Context, NumKind K) {
+  switch (K) {
+  case NK_Int:
+    return llvm::Type::getInt64Ty(Context);
+  case NK_Float:
+    return llvm::Type::getFloatTy(Context);
+  default:
+    return llvm::Type::getDoubleTy(Context);
+  }
+}
+
+/// KindBound - The kind of a value and, for NK_Int, its magnitude bound.
+struct KindBound {
+  NumKind Kind = NK_Double;
+  double Bound = 0;
+};
+
+/// InferState - The state of one inference round over a function body.
+struct InferState {
+  const PrototypeAST &Proto;
+  const TypeSignature &Sig; // current approximation of the signature
+  s::vector<NumKind> Params; // parameters widened by recursive calls
+  bool AllowFloat;
+  unsigned Demoted = 0; // integer operations done in double for their range
+
+  InferState(const PrototypeAST &Proto, const TypeSignature &Sig, bool AllowFloat)
+      : Proto(Proto), Sig(Sig), Params(Sig.Params), AllowFloat(AllowFloat) {}
+
+  KindBound infer(ExprAST &Root);
+  KindBound visit(const ExprAST &E, const KindBound *Operands);
+};
+
+KindBound InferState::infer(ExprAST &Root) {
+  KindBound K;
+  PostOrder(K, Root, [this](KindBound &Out, ExprAST &E, KindBound *Operands, unsigned) {
+    Out = visit(E, Operands);
+    return true;
+  });
+  return K;
+}
+
+/// visit - The kind of E, given the kinds of its operands.
+KindBound InferState::visit(const ExprAST &E, const KindBound *Operands) {
+  switch (E.Kind) {
+  case EK_Number: {
+    double Val = static_cast<const NumberExprAST &>(E).Val;
+    return {LiteralKind(Val, AllowFloat), s::fabs(Val)};
+  }
+  case EK_Variable: {
+    const s::string &Name = static_cast<const VariableExprAST &>(E).Name;
+    for (unsigned i = 0, e = Proto.Args.size(); i != e; ++i)
+      if (Proto.Args[i] == Name)
+        return {Sig.Params[i], Sig.ParamBound};
+    return {};
+  }
+  case EK_Shared:
+    return Operands[0];
+  case EK_Binary: {
+    char Op = static_cast<const BinaryExprAST &>(E).Op;
+    const KindBound &L = Operands[0], &R = Operands[1];
+    double Bound = BinaryBound(Op, L.Bound, R.Bound);
+    NumKind K = BinaryKind(Op, L.Kind, R.Kind, Bound);
+    if (K == NK_Double and JoinKind(L.Kind, R.Kind) == NK_Int)
+      ++Demoted;
+    return {K, Bound};
+  }
+  case EK_Call: {
+    auto &C = static_cast<const CallExprAST &>(E);
+    s::vector<NumKind> ArgKinds;
+    s::vector<double> ArgBounds;
+    for (unsigned i = 0, e = C.Args.size(); i != e; ++i) {
+      ArgKinds.push_back(Operands[i].Kind);
+      ArgBounds.push_back(Operands[i].Bound);
+    }
+    if (C.Callee != Proto.getName() or ArgKinds.size() != Params.size()) {
+      KindBound Result;
+      Result.Kind = CallKind(C.Callee, ArgKinds, ArgBounds, Result.Bound);
+      return Result;
+    }
+
+    // A recursive call always goes to the clone: widen the parameters to
+    // admit its arguments.
+    for (unsigned i = 0, e = Params.size(); i != e; ++i) {
+      NumKind K = ArgKinds[i];
+      if (K == NK_Int and ArgBounds[i] > Sig.ParamBound)
+        K = NK_Double;
+      Params[i] = JoinKind(Params[i], K);
+    }
+    return {Sig.Ret, Sig.RetBound};
+  }
+  }
+  return {};
+}
+
+/// InferWithBound - Infer the signature of F for integral parameters bounded
+/// by ParamBound.  Demoted counts the integer operations left in double.
+static TypeSignature InferWithBound(const FunctionAST &F, bool AllowFloat, double ParamBound,
+                                    unsigned &Demoted) {
+  TypeSignature Sig;
+  Sig.Params.assign(F.Proto->Args.size(), NK_Int);
+  Sig.Ret = NK_None;
+  Sig.ParamBound = ParamBound;
+  Sig.RetBound = 0;
+
+  // Both the parameters and the return kind only grow, and the lattice of
+  // kinds is finite.  The return bound may creep up one step per round
+  // through a recursive call, so it is given up on after a few.
+  for (unsigned Round = 0;; ++Round) {
+    InferState State(*F.Proto, Sig, AllowFloat);
+    KindBound Body = State.infer(*F.Body);
+    NumKind Ret = JoinKind(Sig.Ret, Body.Kind);
+    double RetBound = Ret == NK_Int ? s::max(Sig.RetBound, Body.Bound) : Sig.RetBound;
+    Demoted = State.Demoted;
+    if (Ret == Sig.Ret and RetBound == Sig.RetBound and State.Params == Sig.Params)
+      break;
+    Sig.Ret = Round < 16 ? Ret : NK_Double;
+    Sig.RetBound = RetBound;
+    Sig.Params = State.Params;
+  }
+  return Sig;
+}
+
+TypeSignature InferSignature(const FunctionAST &F, bool AllowFloat) {
+  // Smaller parameter bounds keep more of the body integral, and never less:
+  // look for the largest power of two that does as well as the smallest.
+  unsigned Demoted = 0, Least = 0;
+  TypeSignature Sig = InferWithBound(F, AllowFloat, MaxExactInt, Demoted);
+  if (Demoted and not F.Proto->Args.empty())
+    InferWithBound(F, AllowFloat, 1, Least);
+  if (Least < Demoted) {
+    int Lo = 0, Hi = 53; // Lo does as well as 2^0, Hi does not
+    while (Hi - Lo > 1) {
+      int Mid = (Lo + Hi) / 2;
+      InferWithBound(F, AllowFloat, s::ldexp(1.0, Mid), Demoted);
+      (Demoted == Least ? Lo : Hi) = Mid;
+    }
+    Sig = InferWithBound(F, AllowFloat, s::ldexp(1.0, Lo), Demoted);
+  }
+
+  // A clone that still returns double saves little over the guarded generic
+  // body, which reaches narrower callees through their own wrappers anyway.
+  if (Sig.Ret == NK_None or Sig.Ret == NK_Double)
+    return TypeSignature{s::vector<NumKind>(Sig.Params.size(), NK_Double), NK_Double};
+  return Sig;
+}
+
+} // namespace k
+} // namespace llvmpg
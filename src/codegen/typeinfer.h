@@ -0,0 +1,95 @@
+#ifndef TYPEINFER_H
+#define TYPEINFER_H
+
+#include <parser/parser.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class Type;
+  class LLVMContext;
+}
+
+namespace llvmpg {
+namespace k {
+
+namespace s = std;
+
+//===----------------------------------------------------------------------===//
+// Type Inference
+//===----------------------------------------------------------------------===//
+
+/// NumKind - The narrowest numeric domain a value is proven to live in.  The
+/// kinds are ordered, so the join of two kinds is the larger one.  NK_Int
+/// values are integral and come with a bound on their magnitude that keeps
+/// them within the 53 bit range in which double arithmetic is exact, so i64
+/// arithmetic gives the same result; arithmetic that may leave the range is
+/// done in double.  NK_Float only appears when relaxed precision is allowed.
+enum NumKind : int {
+  NK_None = 0, // no information yet (e.g. the result of unbounded recursion)
+  NK_Int = 1,
+  NK_Float = 2,
+  NK_Double = 3,
+};
+
+inline NumKind JoinKind(NumKind A, NumKind B) { return A < B ? B : A; }
+
+/// MaxExactInt - Largest magnitude up to which every integer is exactly
+/// representable as a double (2^53).
+const double MaxExactInt = 9007199254740992.0;
+
+/// TypeSignature - The inferred parameter and return kinds of a definition.
+/// A generic signature (all NK_Double) needs no specialized clone.
+struct TypeSignature {
+  s::vector<NumKind> Params;
+  NumKind Ret = NK_Double;
+  double ParamBound = MaxExactInt; // magnitude of the NK_Int parameters
+  double RetBound = MaxExactInt;   // magnitude of an NK_Int result
+
+  bool isGeneric() const;
+  /// accepts - Whether a call with arguments of the given kinds (and, for
+  /// NK_Int, magnitudes) can go straight to the specialized clone, i.e. no
+  /// argument needs narrowing or may be out of the clone's range.
+  bool accepts(const s::vector<NumKind> &ArgKinds, const s::vector<double> &ArgBounds) const;
+};
+
+/// Signatures - Signatures of the definitions that have a specialized clone,
+/// keyed by function name.
+extern s::map<s::string, TypeSignature> Signatures;
+
+/// LiteralKind - Kind of the numeric literal V.
+NumKind LiteralKind(double V, bool AllowFloat);
+
+/// BinaryBound - Bound on the magnitude of L Op R for integral operands
+/// bounded by LBound and RBound.
+double BinaryBound(char Op, double LBound, double RBound);
+
+/// BinaryKind - Kind of the result of L Op R, where Bound is the BinaryBound
+/// of the operands.  Integer arithmetic that may leave the exact range is
+/// done in double.
+NumKind BinaryKind(char Op, NumKind L, NumKind R, double Bound);
+
+/// CallKind - Kind of the result of calling Callee with ArgKinds bounded by
+/// ArgBounds, given the signatures known so far.  Sets Bound for an NK_Int
+/// result.
+NumKind CallKind(const s::string &Callee, const s::vector<NumKind> &ArgKinds,
+                 const s::vector<double> &ArgBounds, double &Bound);
+
+/// KindOf/TypeOf - Map between kinds and the LLVM types representing them.
+NumKind KindOf(llvm::Type *Ty);
+llvm::Type *TypeOf(llvm::LLVMContext &Context, NumKind K);
+
+/// InferSignature - Infer the signature of F.  Parameters start out
+/// optimistically integral (callers are guarded at run time by the double ABI
+/// wrapper) and are widened by the arguments of recursive calls; the return
+/// kind is the fixed point of the body's kind.  The guard admits integral
+/// parameters up to the largest ParamBound that keeps as much of the body in
+/// integer arithmetic as any smaller one.  Functions returning double get the
+/// generic signature.
+TypeSignature InferSignature(const FunctionAST &F, bool AllowFloat);
+
+} // namespace k
+} // namespace llvmpg
+
+#endif
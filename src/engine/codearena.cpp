@@ -0,0 +1,297 @@
+#include <engine/codearena.h>
+#include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/Support/Errc.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/Memory.h>
+#include <llvm/Support/Process.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <system_error>
+
+namespace llvmpg {
+namespace k {
+
+namespace s = std;
+
+//===----------------------------------------------------------------------===//
+// Code Arena
+//===----------------------------------------------------------------------===//
+
+/// SystemError - The error of the last failed system call, prefixed with What.
+static llvm::Error SystemError(const char *What) {
+  return llvm::createStringError(s::error_code(errno, s::generic_category()),
+                                 "%s: %s", What, strerror(errno));
+}
+
+llvm::Expected<s::unique_ptr<CodeArena>> CodeArena::Create(size_t Capacity, size_t SlabSize,
+                                                           bool HugePages) {
+  size_t PageSize = llvm::sys::Process::getPageSizeEstimate();
+  if (SlabSize == 0 or SlabSize % PageSize)
+    return llvm::createStringError(llvm::errc::invalid_argument,
+                                   "code slab size must be a multiple of the page size");
+  Capacity = llvm::alignTo(Capacity, SlabSize);
+  // Code in one view reaches data in the other with 32-bit displacements.
+  if (Capacity == 0 or Capacity > (size_t(1) << 30))
+    return llvm::createStringError(llvm::errc::invalid_argument,
+                                   "code arena must hold between one slab and 1 GiB");
+
+  auto A = s::make_unique<CodeArena>();
+  A->Capacity = Capacity;
+  A->SlabSize = SlabSize;
+  A->FD = memfd_create("kaleidoscope-jit", MFD_CLOEXEC);
+  if (A->FD < 0)
+    return SystemError("memfd_create");
+  // The file is sparse: pages are only allocated when written.
+  if (ftruncate(A->FD, Capacity))
+    return SystemError("ftruncate");
+
+  // Reserve room for both views in one go, so that they are Capacity bytes
+  // apart, aligned to a huge page if asked for.
+  size_t Align = HugePages ? HugePageSize : PageSize;
+  size_t Span = 2 * Capacity + Align;
+  void *Base = mmap(nullptr, Span, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (Base == MAP_FAILED)
+    return SystemError("mmap");
+  uintptr_t Begin = llvm::alignTo(reinterpret_cast<uintptr_t>(Base), Align);
+  uintptr_t End = Begin + 2 * Capacity;
+  if (Begin != reinterpret_cast<uintptr_t>(Base))
+    munmap(Base, Begin - reinterpret_cast<uintptr_t>(Base));
+  if (End != reinterpret_cast<uintptr_t>(Base) + Span)
+    munmap(reinterpret_cast<void *>(End), reinterpret_cast<uintptr_t>(Base) + Span - End);
+
+  auto *RX = static_cast<uint8_t *>(mmap(reinterpret_cast<void *>(Begin), Capacity,
+                                         PROT_READ | PROT_EXEC, MAP_SHARED | MAP_FIXED, A->FD, 0));
+  if (RX == MAP_FAILED) {
+    munmap(reinterpret_cast<void *>(Begin), 2 * Capacity);
+    return SystemError("mmap");
+  }
+  A->RX = RX;
+  auto *RW = static_cast<uint8_t *>(mmap(RX + Capacity, Capacity, PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_FIXED, A->FD, 0));
+  if (RW == MAP_FAILED) {
+    munmap(RX + Capacity, Capacity);
+    return SystemError("mmap");
+  }
+  A->RW = RW;
+
+  if (HugePages)
+    A->HugePages = madvise(RX, Capacity, MADV_HUGEPAGE) == 0 and
+                   madvise(RW, Capacity, MADV_HUGEPAGE) == 0;
+  return A;
+}
+
+CodeArena::~CodeArena() {
+  if (RX)
+    munmap(RX, Capacity);
+  if (RW)
+    munmap(RW, Capacity);
+  if (FD >= 0)
+    close(FD);
+}
+
+void CodeArena::setAffinity(const s::string &Group) {
+  s::lock_guard<s::mutex> Guard(Lock);
+  Affinity = Group;
+}
+
+s::unique_ptr<llvm::RuntimeDyld::MemoryManager> CodeArena::createMemoryManager() {
+  s::lock_guard<s::mutex> Guard(Lock);
+  return s::make_unique<ArenaMemoryManager>(*this, Affinity);
+}
+
+size_t CodeArena::allocate(const s::string &Group, size_t Size, size_t Align) {
+  s::lock_guard<s::mutex> Guard(Lock);
+
+  // Pack the object after the last one of its group.
+  auto C = Current.find(Group);
+  if (C != Current.end()) {
+    Slab &B = Slabs[C->second];
+    size_t At = llvm::alignTo(B.Next, Align);
+    if (At + Size <= B.Size) {
+      B.Next = At + Size;
+      B.Live += Size;
+      Used += Size;
+      ++Objects;
+      return C->second + At;
+    }
+    size_t Full = C->second;
+    Current.erase(C);
+    retire(Full);
+  }
+
+  // Start a new slab: a freed one if the object fits, else a run of
+  // fresh ones.
+  size_t Need = llvm::alignTo(Size, SlabSize);
+  size_t Offset;
+  if (Need == SlabSize and not Free.empty()) {
+    Offset = Free.back();
+    Free.pop_back();
+  } else if (Top + Need <= Capacity) {
+    Offset = Top;
+    Top += Need;
+  } else {
+    return Capacity;
+  }
+  Slab &B = Slabs[Offset];
+  B.Size = Need;
+  B.Next = Size;
+  B.Live = Size;
+  Used += Size;
+  ++Objects;
+  // A slab taken up by one large object has no room for its group.
+  if (Size < SlabSize) {
+    B.Filling = true;
+    Current[Group] = Offset;
+  }
+  return Offset;
+}
+
+void CodeArena::release(size_t Offset, size_t Size) {
+  s::lock_guard<s::mutex> Guard(Lock);
+  auto B = Slabs.upper_bound(Offset);
+  if (B == Slabs.begin())
+    return;
+  --B;
+  B->second.Live -= Size;
+  Used -= Size;
+  --Objects;
+  if (B->second.Live)
+    return;
+  // An empty slab its group still fills starts over; any other is freed.
+  if (B->second.Filling)
+    B->second.Next = 0;
+  else
+    freeSlab(B);
+}
+
+void CodeArena::retire(size_t Offset) {
+  auto B = Slabs.find(Offset);
+  B->second.Filling = false;
+  if (not B->second.Live)
+    freeSlab(B);
+}
+
+void CodeArena::freeSlab(s::map<size_t, Slab>::iterator B) {
+  size_t Offset = B->first, Size = B->second.Size;
+  // Hand the pages back to the kernel, and the space back to the arena a
+  // slab at a time.
+  fallocate(FD, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, Offset, Size);
+  for (size_t At = Offset; At != Offset + Size; At += SlabSize)
+    Free.push_back(At);
+  Slabs.erase(B);
+}
+
+CodeMemoryStats CodeArena::stats() {
+  s::lock_guard<s::mutex> Guard(Lock);
+  CodeMemoryStats S;
+  S.Reserved = Capacity;
+  for (auto &KV : Slabs)
+    S.Committed += KV.second.Size;
+  S.Used = Used;
+  S.Objects = Objects;
+  S.Slabs = Slabs.size();
+  S.FreeSlabs = Free.size();
+  S.HugePages = HugePages;
+  return S;
+}
+
+//===----------------------------------------------------------------------===//
+// Arena Memory Manager
+//===----------------------------------------------------------------------===//
+
+ArenaMemoryManager::~ArenaMemoryManager() {
+  if (Size)
+    Arena.release(Begin, Size);
+}
+
+void ArenaMemoryManager::reserveAllocationSpace(uintptr_t CodeSize, uint32_t CodeAlign,
+                                                uintptr_t RODataSize, uint32_t RODataAlign,
+                                                uintptr_t RWDataSize, uint32_t RWDataAlign) {
+  // RuntimeDyld rounds every section up to the largest alignment of its
+  // kind, so regions starting at that alignment hold them all.
+  size_t Align = s::max<size_t>({CodeAlign, RODataAlign, RWDataAlign, 16});
+  size_t CodeBytes = llvm::alignTo(CodeSize, Align);
+  size_t ROBytes = llvm::alignTo(RODataSize, Align);
+  size_t RWBytes = llvm::alignTo(RWDataSize, Align);
+  size_t Total = CodeBytes + ROBytes + RWBytes;
+  if (Total == 0)
+    return;
+
+  Begin = Arena.allocate(Group, Total, Align);
+  if (Begin == Arena.Capacity) {
+    Fallback = s::make_unique<llvm::SectionMemoryManager>();
+    return;
+  }
+  Size = Total;
+  uint8_t *P = Arena.RW + Begin;
+  Code = {P, P + CodeBytes};
+  ROData = {Code.End, Code.End + ROBytes};
+  RWData = {ROData.End, ROData.End + RWBytes};
+}
+
+uint8_t *ArenaMemoryManager::allocateIn(Region &R, uintptr_t Bytes, unsigned Alignment) {
+  auto *P = reinterpret_cast<uint8_t *>(
+      llvm::alignTo(reinterpret_cast<uintptr_t>(R.Next), s::max(Alignment, 1u)));
+  if (not R.Next or P + Bytes > R.End)
+    return nullptr;
+  R.Next = P + Bytes;
+  return P;
+}
+
+uint8_t *ArenaMemoryManager::allocateCodeSection(uintptr_t Bytes, unsigned Alignment,
+                                                 unsigned SectionID,
+                                                 llvm::StringRef SectionName) {
+  if (Fallback)
+    return Fallback->allocateCodeSection(Bytes, Alignment, SectionID, SectionName);
+  uint8_t *P = allocateIn(Code, Bytes, Alignment);
+  if (P)
+    Executable.push_back({P, Bytes});
+  return P;
+}
+
+uint8_t *ArenaMemoryManager::allocateDataSection(uintptr_t Bytes, unsigned Alignment,
+                                                 unsigned SectionID,
+                                                 llvm::StringRef SectionName,
+                                                 bool IsReadOnly) {
+  if (Fallback)
+    return Fallback->allocateDataSection(Bytes, Alignment, SectionID, SectionName,
+                                         IsReadOnly);
+  if (not IsReadOnly)
+    return allocateIn(RWData, Bytes, Alignment);
+  uint8_t *P = allocateIn(ROData, Bytes, Alignment);
+  if (P)
+    Executable.push_back({P, Bytes});
+  return P;
+}
+
+void ArenaMemoryManager::notifyObjectLoaded(llvm::RuntimeDyld &RTDyld,
+                                            const llvm::object::ObjectFile &) {
+  // Code and read-only data run from the executable view; writable data
+  // stays where it was written.
+  for (auto &Section : Executable)
+    RTDyld.mapSectionAddress(Section.first,
+                             llvm::pointerToJITTargetAddress(Section.first - Arena.Capacity));
+}
+
+void ArenaMemoryManager::registerEHFrames(uint8_t *, uint64_t LoadAddr, size_t Bytes) {
+  // The unwinder decodes the frames where the code runs.
+  auto *Load = llvm::jitTargetAddressToPointer<uint8_t *>(LoadAddr);
+  registerEHFramesInProcess(Load, Bytes);
+  EHFrames.push_back({Load, Bytes});
+}
+
+bool ArenaMemoryManager::finalizeMemory(s::string *ErrMsg) {
+  if (Fallback)
+    return Fallback->finalizeMemory(ErrMsg);
+  for (auto &Section : Executable)
+    llvm::sys::Memory::InvalidateInstructionCache(Section.first - Arena.Capacity,
+                                                  Section.second);
+  return false;
+}
+
+} // namespace k
+} // namespace llvmpg
@@ -0,0 +1,157 @@
+#ifndef CODEARENA_H
+#define CODEARENA_H
+
+#include <llvm/ExecutionEngine/RTDyldMemoryManager.h>
+#include <llvm/ExecutionEngine/RuntimeDyld.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/Support/Error.h>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvmpg {
+namespace k {
+
+namespace s = std;
+
+//===----------------------------------------------------------------------===//
+// Code Arena
+//===----------------------------------------------------------------------===//
+
+/// CodeMemoryStats - What a CodeArena holds, in bytes.
+struct CodeMemoryStats {
+  size_t Reserved = 0;    // address space set aside for code and data
+  size_t Committed = 0;   // in slabs handed out to affinity groups
+  size_t Used = 0;        // in the sections of loaded objects
+  size_t Objects = 0;     // objects loaded and not freed
+  size_t Slabs = 0;       // slabs in use
+  size_t FreeSlabs = 0;   // slabs freed and kept for reuse
+  bool HugePages = false; // the kernel took the huge page advice
+
+  /// fragmentation - The share of committed memory holding neither code nor
+  /// data: the unused tails of slabs and the holes left by freed objects.
+  double fragmentation() const { return Committed ? 1 - double(Used) / Committed : 0; }
+};
+
+/// CodeArena - Memory for JIT code and data, carved out of one shared memory
+/// file (memfd) mapped twice: writable, where RuntimeDyld copies and relocates
+/// sections, and executable, where the code runs.  Pages are never remapped,
+/// so objects can be packed next to code that is already running.  This
+/// gives up W^X: all code in the arena can be written through the writable
+/// view, at a fixed distance from it, until the arena is destroyed.
+///
+/// The arena is split into slabs of SlabSize.  Each affinity group (see
+/// setAffinity) fills a slab of its own, so code loaded for the same group
+/// ends up adjacent, on the same pages and iTLB entries.  A slab whose
+/// objects were all freed goes back to the arena and its pages to the
+/// kernel.  With huge pages the arena is aligned to 2 MiB and advised to be
+/// backed by transparent huge pages, which for shared memory the kernel
+/// only grants if /sys/kernel/mm/transparent_hugepage/shmem_enabled allows.
+struct CodeArena {
+  /// Slab - SlabSize bytes (or more, for one large object) at an offset.
+  struct Slab {
+    size_t Size = 0;
+    size_t Next = 0;      // offset of the free tail, from the slab
+    size_t Live = 0;      // bytes held by loaded objects
+    bool Filling = false; // still the slab of an affinity group
+  };
+
+  static constexpr size_t HugePageSize = 2 << 20;
+
+  int FD = -1;
+  uint8_t *RX = nullptr; // executable view
+  uint8_t *RW = nullptr; // writable view, Capacity bytes after RX
+  size_t Capacity = 0;
+  size_t SlabSize = 0;
+  bool HugePages = false;
+
+  s::mutex Lock;
+  size_t Top = 0;                    // offset of the first never used byte
+  s::map<size_t, Slab> Slabs;        // by offset
+  s::map<s::string, size_t> Current; // slab being filled, by group
+  s::vector<size_t> Free;            // offsets of freed slabs of SlabSize
+  s::string Affinity;                // group of the objects loaded next
+  size_t Used = 0;
+  size_t Objects = 0;
+
+  /// Create - Map an arena of Capacity bytes (rounded up to whole slabs),
+  /// handed out in slabs of SlabSize.
+  static llvm::Expected<s::unique_ptr<CodeArena>> Create(size_t Capacity, size_t SlabSize,
+                                                         bool HugePages);
+  ~CodeArena();
+
+  /// setAffinity - Place the objects loaded from now on in the slab of Group.
+  void setAffinity(const s::string &Group);
+
+  /// createMemoryManager - A memory manager for one object, in the current
+  /// affinity group.
+  s::unique_ptr<llvm::RuntimeDyld::MemoryManager> createMemoryManager();
+
+  /// allocate - Set aside Size bytes, aligned to Align, in the slab of
+  /// Group.  Returns the offset, or Capacity if the arena is full.
+  size_t allocate(const s::string &Group, size_t Size, size_t Align);
+  /// release - Give back Size bytes at Offset, freeing their slab if it
+  /// is left empty.
+  void release(size_t Offset, size_t Size);
+
+  CodeMemoryStats stats();
+
+protected:
+  /// retire - Stop filling the slab at Offset, and free it if empty.
+  void retire(size_t Offset);
+  void freeSlab(s::map<size_t, Slab>::iterator B);
+};
+
+/// ArenaMemoryManager - The sections of one object, in a span of a
+/// CodeArena reserved up front.  Sections are written through the writable
+/// view; code and read-only data are mapped to the executable view before
+/// relocation, so the object is linked against the addresses it runs at.
+/// When the arena is full, the object gets ordinary pages of its own.
+struct ArenaMemoryManager : public llvm::RTDyldMemoryManager {
+  /// Region - Where sections of one kind go in the span.
+  struct Region {
+    uint8_t *Next = nullptr;
+    uint8_t *End = nullptr;
+  };
+
+  CodeArena &Arena;
+  s::string Group;
+  size_t Begin = 0; // offset of the span in the arena
+  size_t Size = 0;  // of the span, 0 until reserved
+  Region Code, ROData, RWData;
+  // Local (writable) addresses and sizes of code and read-only sections.
+  s::vector<s::pair<uint8_t *, size_t>> Executable;
+  s::unique_ptr<llvm::SectionMemoryManager> Fallback; // if the arena is full
+
+  ArenaMemoryManager(CodeArena &Arena, s::string Group)
+      : Arena(Arena), Group(s::move(Group)) {}
+  ~ArenaMemoryManager() override;
+
+  bool needsToReserveAllocationSpace() override { return true; }
+  void reserveAllocationSpace(uintptr_t CodeSize, uint32_t CodeAlign, uintptr_t RODataSize,
+                              uint32_t RODataAlign, uintptr_t RWDataSize,
+                              uint32_t RWDataAlign) override;
+  uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment, unsigned SectionID,
+                               llvm::StringRef SectionName) override;
+  uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned SectionID,
+                               llvm::StringRef SectionName, bool IsReadOnly) override;
+
+  using llvm::RTDyldMemoryManager::notifyObjectLoaded;
+  void notifyObjectLoaded(llvm::RuntimeDyld &RTDyld,
+                          const llvm::object::ObjectFile &Obj) override;
+  void registerEHFrames(uint8_t *Addr, uint64_t LoadAddr, size_t Size) override;
+  bool finalizeMemory(s::string *ErrMsg = nullptr) override;
+
+protected:
+  uint8_t *allocateIn(Region &R, uintptr_t Size, unsigned Alignment);
+};
+
+} // namespace k
+} // namespace llvmpg
+
+#endif
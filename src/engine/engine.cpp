@@ -0,0 +1,843 @@
+#include <engine/engine.h>
+#include <engine/jit.h>
+#include <lexer/lexer.h>
+#include <parser/parser.h>
+#include <codegen/builtins.h>
+#include <codegen/codegen.h>
+#include <codegen/optimize.h>
+#include <codegen/typeinfer.h>
+#include <util/spscqueue.h>
+#include <util/threadpool.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <thread>
+
+namespace llvmpg {
+namespace k {
+
+namespace s = std;
+
+//===----------------------------------------------------------------------===//
+// Engine
+//===----------------------------------------------------------------------===//
+
+/// PendingBatch - Top-level expressions started on the pool since the last
+/// barrier (a def, an extern or an impure expression).
+struct PendingBatch {
+  s::deque<double> Values; // in source order; a deque so slots stay put
+  s::vector<llvm::orc::ResourceTrackerSP> Trackers;
+};
+
+/// JobKind - What the JIT does with a CompileJob.
+enum JobKind : int {
+  JK_Barrier = 0,    // wait for the expressions in flight
+  JK_Definition = 1, // link a definition and point its stubs at it
+  JK_Expression = 2, // link an expression, run it and free it
+};
+
+/// CompileJob - A module generated for the JIT, or a barrier.
+struct CompileJob {
+  JobKind Kind = JK_Barrier;
+  llvm::orc::ThreadSafeModule Module;
+  s::vector<s::string> Names; // plain names defined, versioned with Suffix
+  s::string Suffix;
+  s::string Group;            // code placement (Engine::placeCode)
+  bool Pure = false;          // an expression that may run on the pool
+  s::promise<bool> Linked;    // whether a definition linked
+};
+
+/// DefinitionRollback - The version of a def in use before a new one was
+/// lowered, put back if the new one fails to compile or link.
+struct DefinitionRollback {
+  s::string Name;
+  bool Redefined = false;
+  bool Stale = false; // the previous version was in Engine::Stale
+  s::unique_ptr<FunctionAST> AST;
+  uint64_t Hash = 0;
+  s::string IR;
+  decltype(Signatures)::node_type Signature;
+  decltype(KnownEffects)::node_type Effects;
+  s::future<bool> Linked; // of the new version, when linked by the pipeline
+};
+
+/// CompilePipeline - The stages of a compile with EngineOptions::Pipeline:
+/// the parser thread fills Items, the calling thread generates Jobs from
+/// them, and the JIT thread links and runs those.
+struct CompilePipeline {
+  SPSCQueue<TopLevelItem> Items;
+  SPSCQueue<CompileJob> Jobs;
+  s::thread Parser;
+  s::thread JIT;
+  bool Ok = true; // of the JIT thread, read once it is joined
+  s::deque<DefinitionRollback> Pending; // definitions not known to link yet
+
+  explicit CompilePipeline(unsigned Depth) : Items(Depth), Jobs(Depth) {}
+};
+
+/// LogJITError - Report Err on stderr; returns whether there was an error.
+static bool LogJITError(llvm::Error Err) {
+  if (not Err)
+    return false;
+  llvm::logAllUnhandledErrors(s::move(Err), llvm::errs(), "Error: ");
+  return true;
+}
+
+Engine::Engine(const EngineOptions &Opts) : Opts(Opts) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  llvm::InitializeNativeTargetAsmParser();
+
+  auto J = KaleidoscopeJIT::Create(Opts.OptLevel);
+  if (not J) {
+    LogJITError(J.takeError());
+    return;
+  }
+  JIT = s::move(*J);
+  if (Opts.CodeSlabs)
+    LogJITError(JIT->enableCodeArena(Opts.CodeCapacity, Opts.SlabSize, Opts.HugePages));
+  if (Opts.ProcessSymbols)
+    LogJITError(JIT->addProcessSymbols());
+  if (Opts.PerfMap)
+    LogJITError(JIT->enablePerfMap());
+  if (Opts.PerfJITDump)
+    LogJITError(JIT->enablePerfJITDump());
+  if (Opts.GDBRegistration)
+    JIT->enableGDBRegistration();
+
+  // Install standard binary operators, unless the host already did.
+  if (BinopPrecedence.empty()) {
+    BinopPrecedence['<'] = 10;
+    BinopPrecedence['+'] = 20;
+    BinopPrecedence['-'] = 20;
+    BinopPrecedence['*'] = 40;
+  }
+
+  if (Opts.Threads) {
+    Pool = s::make_unique<ThreadPool>(Opts.Threads);
+    Batch = s::make_unique<PendingBatch>();
+  }
+
+  // Have the parser build codegen nodes.
+  Factory = Opts.HashCons ? MakeHashConsFactory(CodegenFactory) : CodegenFactory;
+  startModule();
+}
+
+Engine::~Engine() = default;
+
+void Engine::startModule() {
+  InitializeModule();
+  TheModule->setDataLayout(JIT->getDataLayout());
+}
+
+void Engine::importDefinitions() {
+  if (Opts.OptLevel == 0)
+    return;
+
+  // Imported bodies may call further small definitions, so repeat until
+  // nothing is left to import.
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    s::vector<const Definition *> Wanted;
+    for (llvm::Function &F : *TheModule) {
+      if (not F.isDeclaration())
+        continue;
+      auto It = Definitions.find(F.getName().str());
+      if (It != Definitions.end() and not It->second.IR.empty())
+        Wanted.push_back(&It->second);
+    }
+
+    for (const Definition *D : Wanted) {
+      const s::string &Name = D->AST->Proto->getName();
+      if (not TheModule->getFunction(Name)->isDeclaration())
+        continue; // came with an earlier import
+      auto M = llvm::parseBitcodeFile(llvm::MemoryBufferRef(D->IR, Name), *TheContext);
+      if (not M) {
+        LogJITError(M.takeError());
+        continue;
+      }
+
+      s::set<llvm::Function *> Defined;
+      for (llvm::Function &F : *TheModule)
+        if (not F.isDeclaration())
+          Defined.insert(&F);
+      // Only Name and what it calls are linked in.
+      if (llvm::Linker::linkModules(*TheModule, s::move(*M), llvm::Linker::LinkOnlyNeeded))
+        continue;
+      // The code itself is in the JIT already; these copies are for the
+      // optimizer only, and are dropped after it.
+      for (llvm::Function &F : *TheModule)
+        if (not F.isDeclaration() and not F.hasLocalLinkage() and not Defined.count(&F))
+          F.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+      Changed = true;
+    }
+  }
+}
+
+void Engine::optimizeModule() {
+  FinalizeDebugInfo();
+  importDefinitions();
+  InferFunctionAttrs(*TheModule);
+  OptimizeModule(*TheModule, Opts.OptLevel);
+}
+
+/// InterfaceOf - What code calling Name, defined by D, was compiled against:
+/// its arity, its specialized signature and its inferred effects.  When
+/// callers may have the body itself cloned in (Options.PartialEval) or
+/// inlined (D.IR), every version is new.
+static s::string InterfaceOf(const s::string &Name, const Definition &D) {
+  s::string Interface;
+  if (Options.PartialEval or not D.IR.empty())
+    Interface += 'v' + s::to_string(D.Version) + ':';
+  auto PI = FunctionProtos.find(Name);
+  if (PI != FunctionProtos.end())
+    Interface += s::to_string(PI->second->Args.size());
+  auto SI = Signatures.find(Name);
+  if (SI != Signatures.end()) {
+    Interface += ':';
+    for (NumKind P : SI->second.Params)
+      Interface += static_cast<char>('0' + P);
+    Interface += static_cast<char>('0' + SI->second.Ret);
+    Interface += ':' + s::to_string(SI->second.ParamBound) + ':' +
+                 s::to_string(SI->second.RetBound);
+  }
+  auto EI = KnownEffects.find(Name);
+  if (EI != KnownEffects.end()) {
+    Interface += EI->second.Pure ? 'p' : '-';
+    Interface += EI->second.WillReturn ? 'r' : '-';
+  }
+  return Interface;
+}
+
+/// CollectCallees - The functions called in the body of F.
+static s::set<s::string> CollectCallees(const FunctionAST &F) {
+  s::set<s::string> Callees;
+  int Unused;
+  PostOrder(Unused, *F.Body, [&Callees](int &, ExprAST &E, int *, unsigned) {
+    if (E.Kind == EK_Call)
+      Callees.insert(static_cast<CallExprAST &>(E).Callee);
+    return true;
+  });
+  return Callees;
+}
+
+s::string Engine::placeCode(const s::string &Name, const s::set<s::string> &Callees) {
+  if (not JIT->Arena)
+    return "";
+  // Hot code, and whatever calls it, shares the hot slabs.
+  bool IsHot = Opts.HotFunctions.count(Name);
+  for (const s::string &Callee : Callees)
+    IsHot = IsHot or Hot.count(Callee);
+  if (IsHot)
+    Hot.insert(Name);
+  else
+    Hot.erase(Name);
+  return IsHot ? "hot" : "";
+}
+
+bool Engine::lowerDefinition(Definition &D, s::future<bool> *Linked) {
+  if (not D.AST->codegen())
+    return false;
+  optimizeModule();
+
+  // Keep the IR of a small definition for callers to inline, under the
+  // plain names.
+  D.IR.clear();
+  if (Opts.OptLevel > 0 and Opts.InlineSize) {
+    unsigned Size = 0;
+    for (llvm::Function &F : *TheModule)
+      Size += F.getInstructionCount();
+    if (Size <= Opts.InlineSize) {
+      llvm::raw_string_ostream OS(D.IR);
+      llvm::WriteBitcodeToFile(*TheModule, OS);
+    }
+  }
+
+  // Version the names the module defines (the function and its specialized
+  // clone); everybody else reaches them through stubs under the plain names.
+  // Internal functions, such as partially evaluated clones, stay private.
+  ++D.Version;
+  s::string Suffix = ".v" + s::to_string(D.Version);
+  s::vector<s::string> Names;
+  for (llvm::Function &F : *TheModule) {
+    if (F.isDeclarationForLinker() or F.hasLocalLinkage())
+      continue;
+    Names.push_back(F.getName().str());
+    F.setName(Names.back() + Suffix);
+  }
+
+  CompileJob J;
+  J.Kind = JK_Definition;
+  J.Module = llvm::orc::ThreadSafeModule(s::move(TheModule), s::move(TheContext));
+  J.Names = s::move(Names);
+  J.Suffix = Suffix;
+  J.Group = placeCode(D.AST->Proto->getName(), CollectCallees(*D.AST));
+  if (Linked)
+    *Linked = J.Linked.get_future();
+  startModule();
+  return submit(s::move(J));
+}
+
+bool Engine::flushStale() {
+  // Lower callees before their callers, which may inline them: pick a
+  // definition that reaches no other stale one, if there is one.
+  auto ReachesStale = [this](const s::string &From) {
+    s::set<s::string> Seen{From};
+    s::vector<s::string> Work{From};
+    while (not Work.empty()) {
+      auto It = Definitions.find(Work.back());
+      Work.pop_back();
+      if (It == Definitions.end())
+        continue;
+      for (const s::string &Callee : It->second.Callees) {
+        if (Callee != From and Stale.count(Callee))
+          return true;
+        if (Seen.insert(Callee).second)
+          Work.push_back(Callee);
+      }
+    }
+    return false;
+  };
+
+  // Lower each definition at most once, so mutually recursive definitions
+  // whose interfaces keep changing cannot loop.
+  s::set<s::string> Done;
+  bool Ok = true;
+  while (not Stale.empty()) {
+    auto Next = s::find_if_not(Stale.begin(), Stale.end(), ReachesStale);
+    if (Next == Stale.end())
+      Next = Stale.begin();
+    s::string Name = *Next;
+    Stale.erase(Next);
+    auto It = Definitions.find(Name);
+    if (It == Definitions.end() or not Done.insert(Name).second)
+      continue;
+
+    s::string Interface = InterfaceOf(Name, It->second);
+    if (not lowerDefinition(It->second)) {
+      Ok = false;
+      continue;
+    }
+    if (InterfaceOf(Name, It->second) != Interface)
+      Stale.insert(Callers[Name].begin(), Callers[Name].end());
+  }
+  return Ok;
+}
+
+bool Engine::materialize(const s::set<s::string> &Names) {
+  // Depth first, so that callees are lowered before their callers.  A name
+  // leaves Deferred once its body is parsed, which ends recursive cycles.
+  struct Pending {
+    s::string Name;
+    bool Parsed;
+  };
+  s::vector<Pending> Work;
+  auto Push = [this, &Work](const s::set<s::string> &Callees) {
+    for (const s::string &Callee : Callees)
+      if (Deferred.count(Callee))
+        Work.push_back({Callee, false});
+  };
+  Push(Names);
+
+  bool Ok = true;
+  while (not Work.empty()) {
+    s::string Name = Work.back().Name;
+    if (Work.back().Parsed) {
+      Work.pop_back();
+      Definition &D = Definitions[Name];
+      if (not lowerDefinition(D)) {
+        Definitions.erase(Name);
+        Ok = false;
+        continue;
+      }
+      setCallees(Name, D);
+      continue;
+    }
+
+    auto It = Deferred.find(Name);
+    if (It == Deferred.end()) {
+      Work.pop_back();
+      continue;
+    }
+    DeferredDefinition DD = s::move(It->second);
+    Deferred.erase(It);
+    auto Body = ParseSkimmedBody(*DD.Source, DD.Body);
+    if (not Body) {
+      Work.pop_back();
+      Ok = false;
+      continue;
+    }
+    Work.back().Parsed = true;
+    Definition &D = Definitions[Name];
+    D.AST = Factory.Function(s::move(DD.Proto), s::move(Body));
+    D.Hash = HashFunction(*D.AST);
+    Push(CollectCallees(*D.AST));
+  }
+  return Ok;
+}
+
+void Engine::setCallees(const s::string &Name, Definition &D) {
+  for (const s::string &Callee : D.Callees)
+    Callers[Callee].erase(Name);
+  D.Callees = CollectCallees(*D.AST);
+  for (const s::string &Callee : D.Callees)
+    Callers[Callee].insert(Name);
+}
+
+bool Engine::handleDefinition() {
+  s::unique_ptr<FunctionAST> FnAST;
+  if (Opts.Skim) {
+    SourceRange Body;
+    auto Proto = SkimDefinition(Body);
+    if (not Proto) {
+      // Skip token for error recovery.
+      getNextToken();
+      return false;
+    }
+    // Only new definitions are deferred; a redefinition is compared with
+    // the version in use right away.
+    s::string Name = Proto->getName();
+    if (not Definitions.count(Name) and not HostFunctions.count(Name)) {
+      FunctionProtos[Name] = CreatePrototypeCodegen(Name, Proto->Args);
+      Deferred[Name] = {s::move(Proto), Input, Body};
+      return true;
+    }
+    auto E = ParseSkimmedBody(*Input, Body);
+    if (not E)
+      return false;
+    FnAST = Factory.Function(s::move(Proto), s::move(E));
+  } else {
+    FnAST = ParseDefinition();
+    if (not FnAST) {
+      // Skip token for error recovery.
+      getNextToken();
+      return false;
+    }
+  }
+  return addDefinition(s::move(FnAST));
+}
+
+bool Engine::addDefinition(s::unique_ptr<FunctionAST> FnAST) {
+  s::string Name = FnAST->Proto->getName();
+  if (HostFunctions.count(Name)) {
+    LogError("function redefined");
+    return false;
+  }
+  uint64_t Hash = HashFunction(*FnAST);
+  auto It = Definitions.find(Name);
+  if (It != Definitions.end() and It->second.Hash == Hash and
+      SameFunction(*It->second.AST, *FnAST))
+    return true; // unchanged
+  bool Ok = materialize(CollectCallees(*FnAST));
+
+  DefinitionRollback R;
+  R.Name = Name;
+  R.Redefined = It != Definitions.end();
+  Definition &D = Definitions[Name];
+  s::string Interface = InterfaceOf(Name, D);
+  R.Stale = Stale.count(Name);
+  R.AST = s::move(D.AST);
+  R.Hash = D.Hash;
+  R.IR = D.IR;
+  // What callers were compiled against, put back if the new version fails.
+  R.Signature = Signatures.extract(Name);
+  R.Effects = KnownEffects.extract(Name);
+  D.AST = s::move(FnAST);
+  if (not lowerDefinition(D, Pipe ? &R.Linked : nullptr)) {
+    rollback(R);
+    return false;
+  }
+  D.Hash = Hash;
+  Stale.erase(Name);
+  setCallees(Name, D);
+
+  if (R.Redefined and InterfaceOf(Name, D) != Interface)
+    Stale.insert(Callers[Name].begin(), Callers[Name].end());
+  // The pipeline links the new version later; until then it is assumed to.
+  if (Pipe)
+    Pipe->Pending.push_back(s::move(R));
+  return Ok;
+}
+
+void Engine::rollback(DefinitionRollback &R) {
+  auto It = Definitions.find(R.Name);
+  if (It == Definitions.end())
+    return;
+  Definition &D = It->second;
+  s::string Interface = InterfaceOf(R.Name, D);
+  Signatures.erase(R.Name);
+  KnownEffects.erase(R.Name);
+  if (not R.Redefined) {
+    for (const s::string &Callee : D.Callees)
+      Callers[Callee].erase(R.Name);
+    Definitions.erase(It);
+    return;
+  }
+
+  // Keep the previous version.
+  D.AST = s::move(R.AST);
+  D.Hash = R.Hash;
+  D.IR = s::move(R.IR);
+  FunctionProtos[R.Name] = CreatePrototypeCodegen(R.Name, D.AST->Proto->Args);
+  if (not R.Signature.empty())
+    Signatures.insert(s::move(R.Signature));
+  if (not R.Effects.empty())
+    KnownEffects.insert(s::move(R.Effects));
+  setCallees(R.Name, D);
+  if (R.Stale)
+    Stale.insert(R.Name);
+
+  // Callers generated while the pipeline was linking the failed version were
+  // compiled against it.
+  if (R.Linked.valid() and InterfaceOf(R.Name, D) != Interface)
+    Stale.insert(Callers[R.Name].begin(), Callers[R.Name].end());
+}
+
+bool Engine::settleDefinitions(const s::set<s::string> &Needed) {
+  if (not Pipe)
+    return true;
+  auto &Pending = Pipe->Pending;
+  // Versions of a def are settled in order, so one still being linked holds
+  // back the later ones.
+  s::set<s::string> Held;
+  bool Ok = true;
+  for (auto It = Pending.begin(); It != Pending.end();) {
+    DefinitionRollback &R = *It;
+    bool Ready = R.Linked.wait_for(s::chrono::seconds(0)) == s::future_status::ready;
+    if (Held.count(R.Name) or (not Ready and not Needed.count(R.Name))) {
+      Held.insert(R.Name);
+      ++It;
+      continue;
+    }
+    if (not R.Linked.get()) {
+      Ok = false;
+      // A later version of the same def replaces the previous one in turn,
+      // if it links.
+      auto Later = s::find_if(s::next(It), Pending.end(),
+                              [&R](const DefinitionRollback &L) { return L.Name == R.Name; });
+      if (Later == Pending.end()) {
+        rollback(R);
+      } else {
+        Later->Redefined = R.Redefined;
+        Later->Stale = R.Stale;
+        Later->AST = s::move(R.AST);
+        Later->Hash = R.Hash;
+        Later->IR = s::move(R.IR);
+        Later->Signature = s::move(R.Signature);
+        Later->Effects = s::move(R.Effects);
+      }
+    }
+    It = Pending.erase(It);
+  }
+  return Ok;
+}
+
+s::set<s::string> Engine::reachable(const s::set<s::string> &Roots) {
+  s::set<s::string> Seen = Roots;
+  s::vector<s::string> Work(Roots.begin(), Roots.end());
+  while (not Work.empty()) {
+    auto It = Definitions.find(Work.back());
+    Work.pop_back();
+    if (It == Definitions.end())
+      continue;
+    for (const s::string &Callee : It->second.Callees)
+      if (Seen.insert(Callee).second)
+        Work.push_back(Callee);
+  }
+  return Seen;
+}
+
+bool Engine::handleExtern() {
+  auto ProtoAST = ParseExtern();
+  if (not ProtoAST) {
+    // Skip token for error recovery.
+    getNextToken();
+    return false;
+  }
+  return addExtern(s::move(ProtoAST));
+}
+
+bool Engine::addExtern(s::unique_ptr<PrototypeAST> ProtoAST) {
+  // Declaring records the prototype; every module redeclares it as needed.
+  return ProtoAST->codegen() != nullptr;
+}
+
+bool Engine::drainBatch(s::vector<double> &Results) {
+  if (not Pool)
+    return true;
+  Pool->wait();
+  Results.insert(Results.end(), Batch->Values.begin(), Batch->Values.end());
+  Batch->Values.clear();
+
+  bool Ok = true;
+  for (auto &RT : Batch->Trackers)
+    Ok = not LogJITError(RT->remove()) and Ok;
+  Batch->Trackers.clear();
+  return Ok;
+}
+
+s::string Engine::exprName() {
+  // Expressions on the pool or in the pipeline live side by side, so each
+  // needs its own name.
+  if (not Pool and not Pipe)
+    return "__anon_expr";
+  return "__anon_expr" + s::to_string(NextExpr++);
+}
+
+bool Engine::handleTopLevelExpression() {
+  // Evaluate a top-level expression into an anonymous function.
+  auto FnAST = ParseTopLevelExpr(exprName());
+  if (not FnAST) {
+    // Skip token for error recovery.
+    getNextToken();
+    return false;
+  }
+  return addExpression(s::move(FnAST));
+}
+
+bool Engine::addExpression(s::unique_ptr<FunctionAST> FnAST) {
+  s::string Name = FnAST->Proto->getName();
+  // Callers of what was redefined must be current before anything runs.
+  s::set<s::string> Callees = CollectCallees(*FnAST);
+  // Only what the expression can reach must be known to have linked; the
+  // rest of the pipeline keeps going.
+  bool Ok = settleDefinitions(reachable(Callees));
+  Ok = materialize(Callees) and Ok;
+  Ok = flushStale() and Ok;
+  if (not FnAST->codegen())
+    return false;
+
+  // Compile the expression in a module of its own, run it, and free it.
+  optimizeModule();
+  CompileJob J;
+  J.Kind = JK_Expression;
+  J.Module = llvm::orc::ThreadSafeModule(s::move(TheModule), s::move(TheContext));
+  J.Names.push_back(Name);
+  J.Group = "expr";
+  startModule();
+
+  // Only expressions without side effects may run out of order.
+  auto EI = KnownEffects.find(Name);
+  J.Pure = EI != KnownEffects.end() and EI->second.Pure;
+  if (EI != KnownEffects.end())
+    KnownEffects.erase(EI);
+  return submit(s::move(J)) and Ok;
+}
+
+bool Engine::submit(CompileJob J) {
+  if (not Pipe)
+    return runJob(J);
+  Pipe->Jobs.push(s::move(J));
+  return true;
+}
+
+bool Engine::linkDefinition(CompileJob &J) {
+  // A version that fails to link is removed again, so that its names are
+  // free for the next attempt (a dropped def starts over at .v1).
+  auto RT = JIT->MainJD.createResourceTracker();
+  if (LogJITError(JIT->addModule(s::move(J.Module), RT)))
+    return false;
+  for (const s::string &Name : J.Names) {
+    auto Sym = JIT->lookup(Name + J.Suffix);
+    if (not Sym) {
+      LogJITError(Sym.takeError());
+      LogJITError(RT->remove());
+      return false;
+    }
+    if (LogJITError(JIT->redirect(Name, Sym->getAddress())))
+      return false;
+  }
+  return true;
+}
+
+bool Engine::runJob(CompileJob &J) {
+  if (J.Kind == JK_Barrier)
+    return drainBatch(*Values);
+  if (JIT->Arena)
+    JIT->Arena->setAffinity(J.Group);
+
+  if (J.Kind == JK_Definition) {
+    bool Ok = linkDefinition(J);
+    J.Linked.set_value(Ok);
+    return Ok;
+  }
+
+  auto RT = JIT->MainJD.createResourceTracker();
+  if (LogJITError(JIT->addModule(s::move(J.Module), RT)))
+    return false;
+  auto Sym = JIT->lookup(J.Names.front());
+  if (not Sym) {
+    LogJITError(Sym.takeError());
+    LogJITError(RT->remove());
+    return false;
+  }
+  auto *FP = reinterpret_cast<double (*)()>(static_cast<uintptr_t>(Sym->getAddress()));
+  if (Pool and J.Pure) {
+    double *Slot = &Batch->Values.emplace_back();
+    Batch->Trackers.push_back(RT);
+    Pool->async([FP, Slot]() { *Slot = FP(); });
+    return true;
+  }
+
+  bool Ok = drainBatch(*Values);
+  Values->push_back(FP());
+  return not LogJITError(RT->remove()) and Ok;
+}
+
+bool Engine::compilePipelined() {
+  Pipe = s::make_unique<CompilePipeline>(Opts.QueueDepth);
+  CompilePipeline &P = *Pipe;
+  P.Parser = s::thread([this, &P]() {
+    getNextToken();
+    while (true) {
+      TopLevelItem Item = ParseTopLevelItem([this]() { return exprName(); });
+      if (Item.Kind == IK_End)
+        break;
+      P.Items.push(s::move(Item));
+    }
+    P.Items.close();
+  });
+  P.JIT = s::thread([this, &P]() {
+    CompileJob J;
+    while (P.Jobs.pop(J))
+      P.Ok = runJob(J) and P.Ok;
+  });
+
+  bool Ok = true;
+  TopLevelItem Item;
+  while (P.Items.pop(Item)) {
+    switch (Item.Kind) {
+    case IK_Definition:
+      // Definitions and externs are barriers for the expressions in flight.
+      submit(CompileJob());
+      Ok = Item.Function and addDefinition(s::move(Item.Function)) and Ok;
+      break;
+    case IK_Extern:
+      submit(CompileJob());
+      Ok = Item.Proto and addExtern(s::move(Item.Proto)) and Ok;
+      break;
+    default:
+      Ok = Item.Function and addExpression(s::move(Item.Function)) and Ok;
+      break;
+    }
+    Ok = settleDefinitions({}) and Ok;
+  }
+  submit(CompileJob());
+  // Rolling back a definition may leave its callers stale.
+  s::set<s::string> Linking;
+  for (const DefinitionRollback &R : P.Pending)
+    Linking.insert(R.Name);
+  Ok = settleDefinitions(Linking) and Ok;
+  Ok = flushStale() and Ok;
+
+  P.Jobs.close();
+  P.Parser.join();
+  P.JIT.join();
+  Ok = P.Ok and Ok;
+  Pipe.reset();
+  return Ok;
+}
+
+bool Engine::compile(s::vector<double> &Results, const s::string &Source) {
+  if (not JIT)
+    return false;
+
+  // Kept for the bodies skimmed from it.
+  Input = s::make_shared<const s::string>(Source);
+  SetLexerInput(Source);
+  Values = &Results;
+
+  bool Ok = true;
+  if (Opts.Pipeline and not Opts.Skim and not Opts.HashCons) {
+    Ok = compilePipelined();
+    Values = nullptr;
+    return Ok;
+  }
+
+  getNextToken();
+  while (CurTok != tok_eof) {
+    switch (CurTok) {
+    case ';': // ignore top-level semicolons.
+      getNextToken();
+      break;
+    case tok_def:
+      // Definitions and externs are barriers for the expressions in flight.
+      Ok = drainBatch(Results) and Ok;
+      Ok = handleDefinition() and Ok;
+      break;
+    case tok_extern:
+      Ok = drainBatch(Results) and Ok;
+      Ok = handleExtern() and Ok;
+      break;
+    default:
+      Ok = handleTopLevelExpression() and Ok;
+      break;
+    }
+  }
+  Ok = drainBatch(Results) and Ok;
+  Ok = flushStale() and Ok;
+  Values = nullptr;
+  return Ok;
+}
+
+bool Engine::compileFile(s::vector<double> &Results, const s::string &Path) {
+  s::ifstream In(Path);
+  if (not In) {
+    LogError(("cannot open " + Path).c_str());
+    return false;
+  }
+  s::string Source((s::istreambuf_iterator<char>(In)), s::istreambuf_iterator<char>());
+  return compile(Results, Source);
+}
+
+CodeMemoryStats Engine::codeMemoryStats() const {
+  return JIT and JIT->Arena ? JIT->Arena->stats() : CodeMemoryStats();
+}
+
+void *Engine::lookupAddress(const s::string &Name, unsigned Arity) {
+  auto PI = FunctionProtos.find(Name);
+  if (not JIT or PI == FunctionProtos.end() or PI->second->Args.size() != Arity)
+    return nullptr;
+  if (Deferred.count(Name) and not materialize({Name}))
+    return nullptr;
+
+  auto Sym = JIT->lookup(Name);
+  if (not Sym) {
+    LogJITError(Sym.takeError());
+    return nullptr;
+  }
+  return reinterpret_cast<void *>(static_cast<uintptr_t>(Sym->getAddress()));
+}
+
+bool Engine::registerAddress(const s::string &Name, void *Addr, unsigned Arity) {
+  auto PI = FunctionProtos.find(Name);
+  if (not JIT or Definitions.count(Name) or HostFunctions.count(Name) or
+      (PI != FunctionProtos.end() and PI->second->Args.size() != Arity))
+    return false;
+
+  if (LogJITError(JIT->defineAbsolute(Name, Addr)))
+    return false;
+
+  // Declare it as if by an extern, so sources can call it straight away.
+  if (PI == FunctionProtos.end()) {
+    s::vector<s::string> Args;
+    for (unsigned i = 0; i != Arity; ++i)
+      Args.push_back("x" + s::to_string(i));
+    FunctionProtos[Name] = CreatePrototypeCodegen(Name, s::move(Args));
+  }
+  HostFunctions.insert(Name);
+  HostNames.insert(Name);
+  return true;
+}
+
+} // namespace k
+} // namespace llvmpg
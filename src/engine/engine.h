@@ -0,0 +1,252 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <lexer/lexer.h>
+#include <cstdint>
+#include <future>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace llvmpg {
+
+struct ThreadPool;
+
+namespace k {
+
+namespace s = std;
+
+struct KaleidoscopeJIT;
+struct CodeMemoryStats;
+struct PendingBatch;
+struct CompilePipeline;
+struct CompileJob;
+struct DefinitionRollback;
+struct FunctionAST;
+struct PrototypeAST;
+
+//===----------------------------------------------------------------------===//
+// Engine
+//===----------------------------------------------------------------------===//
+
+/// FunctionArity - The number of parameters of FnT, which must be a
+/// Kaleidoscope function type double(double, ...).
+template <typename FnT>
+struct FunctionArity;
+
+template <typename... ArgTs>
+struct FunctionArity<double(ArgTs...)> {
+  static_assert((s::is_same<ArgTs, double>::value and ...),
+                "Kaleidoscope functions only take double arguments");
+  static constexpr unsigned value = sizeof...(ArgTs);
+};
+
+/// EngineOptions - How an Engine compiles.  Codegen options (fast-math, type
+/// inference, ...) are taken from Options in codegen.h.
+struct EngineOptions {
+  unsigned OptLevel = 2;      // IR and machine code optimization level, 0-3
+  bool ProcessSymbols = true; // resolve unknown externs in the host process
+  // With Threads > 0, top-level expressions that only reach pure functions
+  // run on a work-stealing pool of that many threads, in parallel with the
+  // rest of the batch up to the next def or extern.  Results keep source order.
+  unsigned Threads = 0;
+  bool HashCons = false; // share identical subexpressions (MakeHashConsFactory)
+  // Skim definitions: parse only their prototypes, and parse and compile a
+  // body when something first calls or looks up the function.
+  bool Skim = false;
+  // Parse on a thread of its own, generate and optimize IR on the calling
+  // thread, and link and run the code on a third, with at most QueueDepth
+  // items waiting between two stages.  A definition the JIT then fails to
+  // link is rolled back to its previous version before the next expression
+  // that can reach it runs.  Skim and HashCons parse on the codegen thread
+  // too, so they compile one item after another.
+  bool Pipeline = false;
+  unsigned QueueDepth = 64;
+  // Definitions whose optimized IR has at most this many instructions are
+  // kept as bitcode, and callers compiled later get available_externally
+  // copies they can inline (with OptLevel > 0).  Zero turns this off.
+  unsigned InlineSize = 50;
+  // Load code into slabs of one arena (CodeArena) rather than into pages of
+  // its own per module.  Definitions in HotFunctions, an affinity hint such
+  // as the top of a profile, share slabs with each other and with the
+  // definitions calling them; other definitions fill slabs in source order,
+  // and top-level expressions slabs of their own.  The price is W^X: the
+  // arena stays mapped writable at a second address for its lifetime, as
+  // later objects are packed into pages already running code.
+  bool CodeSlabs = false;
+  bool HugePages = false;           // back the arena with transparent huge pages
+  size_t CodeCapacity = 256 << 20;  // bytes of address space for the arena
+  size_t SlabSize = 64 << 10;
+  s::set<s::string> HotFunctions;
+  // Profiling and debugging of the generated code; all off by default.  Line
+  // information needs Options.DebugInfo as well.
+  bool PerfMap = false;         // name functions in /tmp/perf-<pid>.map
+  bool PerfJITDump = false;     // write a jitdump file for perf inject
+  bool GDBRegistration = false; // register code with the GDB JIT interface
+};
+
+/// Definition - A def compiled by an Engine.  Its AST is kept so that it can
+/// be lowered again when what it assumed about its callees changes, and the
+/// IR of a small one so that callers can inline it.
+struct Definition {
+  s::unique_ptr<FunctionAST> AST;
+  uint64_t Hash = 0;         // HashFunction of AST
+  unsigned Version = 0;      // times lowered
+  s::set<s::string> Callees; // functions called from the body
+  s::string IR;              // bitcode of a small definition, for inlining
+};
+
+/// DeferredDefinition - A def whose body was skimmed (EngineOptions::Skim),
+/// found at Body in Source.
+struct DeferredDefinition {
+  s::unique_ptr<PrototypeAST> Proto;
+  s::shared_ptr<const s::string> Source;
+  SourceRange Body;
+};
+
+/// Engine - Compiles Kaleidoscope source into native code in the current
+/// process and hands out typed pointers to it:
+///
+///   k::Engine E;
+///   E.registerFunction<double(double)>("scale", &Scale);
+///   E.compile("def poly(x y) scale(x)*x + 3*y;");
+///   auto *Poly = E.lookup<double(double, double)>("poly");
+///   double V = Poly(1.0, 2.0);
+///
+/// The front end keeps its state in globals (lexer.h, parser.h, codegen.h),
+/// so only one Engine may exist at a time and it must not be used from two
+/// threads at once.  The compiled functions may be called from any thread.
+/// Errors are reported on stderr, like everywhere else in the front end.
+///
+/// Definitions can be replaced: compiling a def again with a different body
+/// (by structural hash) lowers it under a new version and swaps it in through
+/// the stub callers and lookup pointers go through; an unchanged def is
+/// skipped.  Callers are only lowered again when the facts they were compiled
+/// against (arity, type signature, purity, or the body of a small callee they
+/// may have inlined) changed.  So recompiling an edited file costs in
+/// proportion to the edit.  Replaced code is never freed, as
+/// another thread may still be running it.
+struct Engine {
+  EngineOptions Opts;
+  s::unique_ptr<KaleidoscopeJIT> JIT;
+  s::map<s::string, Definition> Definitions;
+  s::map<s::string, s::set<s::string>> Callers; // reverse of Definition::Callees
+  s::set<s::string> HostFunctions;              // registered with registerFunction
+  s::set<s::string> Stale; // definitions to lower again before running code
+  s::set<s::string> Hot;   // definitions placed in the hot slabs
+  s::map<s::string, DeferredDefinition> Deferred; // with Opts.Skim
+  s::shared_ptr<const s::string> Input;           // source of the current compile
+  s::unique_ptr<ThreadPool> Pool;      // with Opts.Threads
+  s::unique_ptr<PendingBatch> Batch;   // expressions running on Pool
+  s::unique_ptr<CompilePipeline> Pipe; // during a compile with Opts.Pipeline
+  s::vector<double> *Values = nullptr; // results of the compile in progress
+  unsigned NextExpr = 0;               // for naming expressions side by side
+
+  Engine(const EngineOptions &Opts = EngineOptions());
+  ~Engine();
+
+  /// compile - Compile the definitions and externs in Source, and evaluate
+  /// its top-level expressions in order, appending their values to Results.
+  /// Returns false if any item failed; a def that fails to compile keeps its
+  /// previous version.
+  bool compile(s::vector<double> &Results, const s::string &Source);
+  bool compile(const s::string &Source) {
+    s::vector<double> Results;
+    return compile(Results, Source);
+  }
+
+  /// compileFile - compile the contents of the file at Path.
+  bool compileFile(s::vector<double> &Results, const s::string &Path);
+  bool compileFile(const s::string &Path) {
+    s::vector<double> Results;
+    return compileFile(Results, Path);
+  }
+
+  /// lookup - The native code of the function Name, or nullptr if there is no
+  /// such function or it does not take as many arguments as FnT.
+  template <typename FnT>
+  FnT *lookup(const s::string &Name) {
+    return reinterpret_cast<FnT *>(lookupAddress(Name, FunctionArity<FnT>::value));
+  }
+
+  /// registerFunction - Make the host function Fn callable from Kaleidoscope
+  /// as Name, bound directly to its address.  No extern is needed.
+  template <typename FnT>
+  bool registerFunction(const s::string &Name, FnT *Fn) {
+    return registerAddress(Name, reinterpret_cast<void *>(Fn), FunctionArity<FnT>::value);
+  }
+
+  /// codeMemoryStats - Usage of the code arena (EngineOptions::CodeSlabs);
+  /// all zero without one.
+  CodeMemoryStats codeMemoryStats() const;
+
+  void *lookupAddress(const s::string &Name, unsigned Arity);
+  bool registerAddress(const s::string &Name, void *Addr, unsigned Arity);
+
+protected:
+  bool handleDefinition();
+  bool handleExtern();
+  bool handleTopLevelExpression();
+
+  /// addDefinition, addExtern, addExpression - Compile a parsed item.
+  bool addDefinition(s::unique_ptr<FunctionAST> FnAST);
+  bool addExtern(s::unique_ptr<PrototypeAST> ProtoAST);
+  bool addExpression(s::unique_ptr<FunctionAST> FnAST);
+  /// exprName - The name of the next top-level expression.
+  s::string exprName();
+
+  /// compilePipelined - Compile the lexer input with Opts.Pipeline.
+  bool compilePipelined();
+  /// submit - Hand J to the JIT: run it now, or queue it for the JIT
+  /// thread of the pipeline (returning true).
+  bool submit(CompileJob J);
+  /// runJob - Link or run the code of J.
+  bool runJob(CompileJob &J);
+  /// linkDefinition - Link the definition of J and point its stubs at it.
+  bool linkDefinition(CompileJob &J);
+
+  /// lowerDefinition - Generate, optimize and link the next version of D and
+  /// point its stubs at it.  With the pipeline, only generation is reported
+  /// on; Linked is set to the result of linking, if given.
+  bool lowerDefinition(Definition &D, s::future<bool> *Linked = nullptr);
+  /// rollback - Put back the version of a def saved in R, after the one
+  /// replacing it failed.
+  void rollback(DefinitionRollback &R);
+  /// settleDefinitions - Roll back the definitions the pipeline failed to
+  /// link, in order.  Waits for those named in Needed and leaves the others
+  /// still being linked for later.  Returns false if any failed.
+  bool settleDefinitions(const s::set<s::string> &Needed);
+  /// reachable - Roots and the definitions they call, directly or not.
+  s::set<s::string> reachable(const s::set<s::string> &Roots);
+  /// flushStale - Lower the definitions in Stale, and their callers in turn
+  /// if that changes their interface.
+  bool flushStale();
+  /// materialize - Parse and lower the deferred definitions among Names, and
+  /// those they call in turn.
+  bool materialize(const s::set<s::string> &Names);
+  /// placeCode - The affinity group of the slabs the code of Name, calling
+  /// Callees, is loaded into.
+  s::string placeCode(const s::string &Name, const s::set<s::string> &Callees);
+  /// setCallees - Record the functions the body of D calls.
+  void setCallees(const s::string &Name, Definition &D);
+
+  /// drainBatch - Wait for the expressions running on Pool, append their
+  /// values to Results and free their code.
+  bool drainBatch(s::vector<double> &Results);
+
+  /// startModule - Open a fresh module for the next item.
+  void startModule();
+  /// importDefinitions - Add available_externally copies of the small
+  /// definitions the current module calls.
+  void importDefinitions();
+  /// optimizeModule - Finish the current module and run the optimizer on it.
+  void optimizeModule();
+};
+
+} // namespace k
+} // namespace llvmpg
+
+#endif
@@ -0,0 +1,188 @@
+#include <engine/jit.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutorProcessControl.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/Object/SymbolSize.h>
+#include <llvm/Support/Errc.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Process.h>
+#include <string>
+
+namespace llvmpg {
+namespace k {
+
+namespace s = std;
+
+//===----------------------------------------------------------------------===//
+// JIT
+//===----------------------------------------------------------------------===//
+
+PerfMapListener::PerfMapListener() {
+  s::string Path = "/tmp/perf-" + s::to_string(llvm::sys::Process::getProcessId()) + ".map";
+  File = fopen(Path.c_str(), "a");
+}
+
+PerfMapListener::~PerfMapListener() {
+  if (File)
+    fclose(File);
+}
+
+void PerfMapListener::notifyObjectLoaded(ObjectKey, const llvm::object::ObjectFile &Obj,
+                                         const llvm::RuntimeDyld::LoadedObjectInfo &L) {
+  // The debug object has its sections relocated to where they were loaded.
+  llvm::object::OwningBinary<llvm::object::ObjectFile> DebugObj = L.getObjectForDebug(Obj);
+  if (not File or not DebugObj.getBinary())
+    return;
+
+  s::lock_guard<s::mutex> Guard(Lock);
+  for (auto &P : llvm::object::computeSymbolSizes(*DebugObj.getBinary())) {
+    llvm::object::SymbolRef Sym = P.first;
+    auto Type = Sym.getType();
+    if (not Type) {
+      llvm::consumeError(Type.takeError());
+      continue;
+    }
+    if (*Type != llvm::object::SymbolRef::ST_Function)
+      continue;
+
+    auto Name = Sym.getName();
+    auto Addr = Sym.getAddress();
+    if (not Name or not Addr) {
+      llvm::consumeError(Name.takeError());
+      llvm::consumeError(Addr.takeError());
+      continue;
+    }
+    fprintf(File, "%llx %llx %s\n", static_cast<unsigned long long>(*Addr),
+            static_cast<unsigned long long>(P.second), Name->str().c_str());
+  }
+  fflush(File);
+}
+
+KaleidoscopeJIT::KaleidoscopeJIT(s::unique_ptr<llvm::orc::ExecutionSession> ES,
+                                 llvm::orc::JITTargetMachineBuilder JTMB,
+                                 llvm::DataLayout DL)
+    : ES(s::move(ES)), DL(s::move(DL)), Mangle(*this->ES, this->DL),
+      ObjectLayer(*this->ES,
+                  [this]() -> s::unique_ptr<llvm::RuntimeDyld::MemoryManager> {
+                    if (Arena)
+                      return Arena->createMemoryManager();
+                    return s::make_unique<llvm::SectionMemoryManager>();
+                  }),
+      CompileLayer(*this->ES, ObjectLayer,
+                   s::make_unique<llvm::orc::ConcurrentIRCompiler>(s::move(JTMB))),
+      MainJD(this->ES->createBareJITDylib("<main>")),
+      Stubs(llvm::orc::createLocalIndirectStubsManagerBuilder(
+          llvm::Triple(llvm::sys::getProcessTriple()))()) {}
+
+KaleidoscopeJIT::~KaleidoscopeJIT() {
+  if (auto Err = ES->endSession())
+    ES->reportError(s::move(Err));
+}
+
+llvm::Expected<s::unique_ptr<KaleidoscopeJIT>> KaleidoscopeJIT::Create(unsigned OptLevel) {
+  auto EPC = llvm::orc::SelfExecutorProcessControl::Create();
+  if (not EPC)
+    return EPC.takeError();
+
+  auto ES = s::make_unique<llvm::orc::ExecutionSession>(s::move(*EPC));
+
+  // Generate code for the CPU we run on.
+  auto JTMB = llvm::orc::JITTargetMachineBuilder::detectHost();
+  if (not JTMB)
+    return JTMB.takeError();
+  switch (OptLevel) {
+  case 0:
+    JTMB->setCodeGenOptLevel(llvm::CodeGenOpt::None);
+    break;
+  case 1:
+    JTMB->setCodeGenOptLevel(llvm::CodeGenOpt::Less);
+    break;
+  case 2:
+    JTMB->setCodeGenOptLevel(llvm::CodeGenOpt::Default);
+    break;
+  default:
+    JTMB->setCodeGenOptLevel(llvm::CodeGenOpt::Aggressive);
+    break;
+  }
+
+  auto DL = JTMB->getDefaultDataLayoutForTarget();
+  if (not DL)
+    return DL.takeError();
+
+  return s::make_unique<KaleidoscopeJIT>(s::move(ES), s::move(*JTMB), s::move(*DL));
+}
+
+llvm::Error KaleidoscopeJIT::addModule(llvm::orc::ThreadSafeModule TSM,
+                                       llvm::orc::ResourceTrackerSP RT) {
+  if (not RT)
+    RT = MainJD.getDefaultResourceTracker();
+  return CompileLayer.add(RT, s::move(TSM));
+}
+
+llvm::Error KaleidoscopeJIT::addProcessSymbols() {
+  auto Generator = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+      DL.getGlobalPrefix());
+  if (not Generator)
+    return Generator.takeError();
+  MainJD.addGenerator(s::move(*Generator));
+  return llvm::Error::success();
+}
+
+llvm::Error KaleidoscopeJIT::enableCodeArena(size_t Capacity, size_t SlabSize,
+                                             bool HugePages) {
+  if (Arena)
+    return llvm::Error::success();
+  auto A = CodeArena::Create(Capacity, SlabSize, HugePages);
+  if (not A)
+    return A.takeError();
+  Arena = s::move(*A);
+  return llvm::Error::success();
+}
+
+llvm::Error KaleidoscopeJIT::enablePerfMap() {
+  if (PerfMap)
+    return llvm::Error::success();
+  auto Listener = s::make_unique<PerfMapListener>();
+  if (not Listener->File)
+    return llvm::createStringError(llvm::errc::io_error, "cannot open the perf map file");
+  PerfMap = s::move(Listener);
+  ObjectLayer.registerJITEventListener(*PerfMap);
+  return llvm::Error::success();
+}
+
+llvm::Error KaleidoscopeJIT::enablePerfJITDump() {
+  llvm::JITEventListener *Listener = llvm::JITEventListener::createPerfJITEventListener();
+  if (not Listener)
+    return llvm::createStringError(llvm::errc::not_supported,
+                                   "LLVM was built without perf support");
+  ObjectLayer.registerJITEventListener(*Listener);
+  return llvm::Error::success();
+}
+
+void KaleidoscopeJIT::enableGDBRegistration() {
+  ObjectLayer.registerJITEventListener(
+      *llvm::JITEventListener::createGDBRegistrationListener());
+}
+
+llvm::Error KaleidoscopeJIT::redirect(llvm::StringRef Name, llvm::JITTargetAddress Addr) {
+  if (Stubs->findStub(Name, true))
+    return Stubs->updatePointer(Name, Addr);
+
+  if (auto Err = Stubs->createStub(Name, Addr, llvm::JITSymbolFlags::Exported))
+    return Err;
+  llvm::orc::SymbolMap Symbols;
+  Symbols[Mangle(Name)] = Stubs->findStub(Name, true);
+  return MainJD.define(llvm::orc::absoluteSymbols(s::move(Symbols)));
+}
+
+llvm::Error KaleidoscopeJIT::defineAbsolute(llvm::StringRef Name, void *Addr) {
+  llvm::orc::SymbolMap Symbols;
+  Symbols[Mangle(Name)] = llvm::JITEvaluatedSymbol(
+      llvm::pointerToJITTargetAddress(Addr), llvm::JITSymbolFlags::Exported);
+  return MainJD.define(llvm::orc::absoluteSymbols(s::move(Symbols)));
+}
+
+} // namespace k
+} // namespace llvmpg
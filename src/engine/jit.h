@@ -0,0 +1,113 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <engine/codearena.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/Mangling.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/DataLayout.h>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+
+namespace llvmpg {
+namespace k {
+
+namespace s = std;
+
+//===----------------------------------------------------------------------===//
+// JIT
+//===----------------------------------------------------------------------===//
+
+/// PerfMapListener - Appends the functions of every object the JIT loads to
+/// /tmp/perf-<pid>.map, where perf looks up the names of JIT code.  Entries
+/// are never retracted, so the address of freed code (a finished top-level
+/// expression) may show up under its old name.
+struct PerfMapListener : public llvm::JITEventListener {
+  FILE *File = nullptr;
+  s::mutex Lock;
+
+  PerfMapListener();
+  ~PerfMapListener() override;
+
+  void notifyObjectLoaded(ObjectKey K, const llvm::object::ObjectFile &Obj,
+                          const llvm::RuntimeDyld::LoadedObjectInfo &L) override;
+};
+
+/// KaleidoscopeJIT - A small ORC JIT for the modules produced by codegen:
+/// IR is compiled for the host CPU and linked in process by RuntimeDyld.
+/// Every definition lives in MainJD.  Names bound with redirect are
+/// indirect stubs, so their code can be replaced while it is in use.
+/// Objects are loaded into pages of their own, or packed into Arena once
+/// enableCodeArena was called.
+struct KaleidoscopeJIT {
+  s::unique_ptr<llvm::orc::ExecutionSession> ES;
+  llvm::DataLayout DL;
+  llvm::orc::MangleAndInterner Mangle;
+  s::unique_ptr<CodeArena> Arena; // outlives the objects in ObjectLayer
+  llvm::orc::RTDyldObjectLinkingLayer ObjectLayer;
+  llvm::orc::IRCompileLayer CompileLayer;
+  llvm::orc::JITDylib &MainJD;
+  s::unique_ptr<llvm::orc::IndirectStubsManager> Stubs;
+  s::unique_ptr<PerfMapListener> PerfMap;
+
+  KaleidoscopeJIT(s::unique_ptr<llvm::orc::ExecutionSession> ES,
+                  llvm::orc::JITTargetMachineBuilder JTMB, llvm::DataLayout DL);
+  ~KaleidoscopeJIT();
+
+  /// Create - Make a JIT for the host, generating code at OptLevel (0-3).
+  static llvm::Expected<s::unique_ptr<KaleidoscopeJIT>> Create(unsigned OptLevel);
+
+  const llvm::DataLayout &getDataLayout() const { return DL; }
+
+  /// addModule - Add TSM to MainJD, tracked by RT (the default tracker if
+  /// null) so it can be removed again.
+  llvm::Error addModule(llvm::orc::ThreadSafeModule TSM,
+                        llvm::orc::ResourceTrackerSP RT = nullptr);
+
+  /// addProcessSymbols - Resolve otherwise undefined symbols, such as libm
+  /// functions, from the host process.
+  llvm::Error addProcessSymbols();
+
+  /// enableCodeArena - Load the objects from now on into a CodeArena of
+  /// Capacity bytes, in slabs of SlabSize.
+  llvm::Error enableCodeArena(size_t Capacity, size_t SlabSize, bool HugePages);
+
+  /// enablePerfMap - Name the code loaded from now on in the perf map file
+  /// (see PerfMapListener).
+  llvm::Error enablePerfMap();
+
+  /// enablePerfJITDump - Write a jitdump file with the symbols, code and line
+  /// tables of the code loaded from now on, for `perf inject --jit`.  Fails
+  /// if LLVM was built without perf support.
+  llvm::Error enablePerfJITDump();
+
+  /// enableGDBRegistration - Register the objects loaded from now on through
+  /// the GDB JIT interface, so debuggers see their symbols and debug info.
+  void enableGDBRegistration();
+
+  /// redirect - Make calls to Name jump to Addr.  The first redirect of a
+  /// name defines it in MainJD as a stub; later ones repoint the stub with a
+  /// single pointer store, so threads running through it see either the old
+  /// or the new code, and code bound to the stub earlier follows along.
+  llvm::Error redirect(llvm::StringRef Name, llvm::JITTargetAddress Addr);
+
+  /// defineAbsolute - Define Name as the host address Addr.
+  llvm::Error defineAbsolute(llvm::StringRef Name, void *Addr);
+
+  llvm::Expected<llvm::JITEvaluatedSymbol> lookup(llvm::StringRef Name) {
+    return ES->lookup({&MainJD}, Mangle(Name.str()));
+  }
+};
+
+} // namespace k
+} // namespace llvmpg
+
+#endif
@@ -10,18 +10,81 @@ namespace s = std;
 
 s::string IdentifierStr; // Filled in if tok_identifier
 double NumVal;           // Filled in if tok_number
+SourceLocation CurLoc;
+size_t CurOffset = 0;
 
-/// gettok - Return the next token from standard input.
-int gettok() {
-  static int LastChar = ' ';
+// The lexer input: standard input, or the string in Source.
+static bool FromStdin = true;
+static s::string Source;
+static size_t SourcePos = 0;
+static int LastChar = ' ';
+static SourceLocation LexLoc = {1, 0}; // position of LastChar
+
+/// readchar - Read the next character of the lexer input.
+static int readchar() {
+  if (FromStdin)
+    return getchar();
+  if (SourcePos < Source.size())
+    return static_cast<unsigned char>(Source[SourcePos++]);
+  return EOF;
+}
+
+/// nextchar - Read the next character, keeping track of its position.
+static int nextchar() {
+  if (LastChar == '\n') {
+    LexLoc.Line++;
+    LexLoc.Col = 0;
+  }
+  int C = readchar();
+  LexLoc.Col++;
+  return C;
+}
+
+void SetLexerInput(const s::string &Src, SourceLocation Start) {
+  FromStdin = false;
+  Source = Src;
+  SourcePos = 0;
+  LastChar = ' ';
+  LexLoc = {Start.Line, Start.Col - 1};
+}
 
+void SetLexerStdin() {
+  FromStdin = true;
+  Source.clear();
+  SourcePos = 0;
+  LastChar = ' ';
+  LexLoc = {1, 0};
+}
+
+LexerState SaveLexerState() {
+  return {FromStdin, s::move(Source), SourcePos,     LastChar, LexLoc,
+          CurLoc,    CurOffset,         IdentifierStr, NumVal};
+}
+
+void RestoreLexerState(LexerState &&State) {
+  FromStdin = State.FromStdin;
+  Source = s::move(State.Source);
+  SourcePos = State.SourcePos;
+  LastChar = State.LastChar;
+  LexLoc = State.LexLoc;
+  CurLoc = State.CurLoc;
+  CurOffset = State.CurOffset;
+  IdentifierStr = s::move(State.IdentifierStr);
+  NumVal = State.NumVal;
+}
+
+/// gettok - Return the next token from the lexer input.
+int gettok() {
   // Skip any whitespace.
   while (isspace(LastChar))
-    LastChar = getchar();
+    LastChar = nextchar();
+
+  CurLoc = LexLoc;
+  CurOffset = LastChar == EOF ? SourcePos : SourcePos - 1;
 
   if (isalpha(LastChar)) { // identifier: [a-zA-Z][a-zA-Z0-9]*
     IdentifierStr = LastChar;
-    while (isalnum((LastChar = getchar())))
+    while (isalnum((LastChar = nextchar())))
       IdentifierStr += LastChar;
 
     if (IdentifierStr == "def")
@@ -35,7 +98,7 @@ int gettok() {
     s::string NumStr;
     do {
       NumStr += LastChar;
-      LastChar = getchar();
+      LastChar = nextchar();
     } while (isdigit(LastChar) or LastChar == '.');
 
     NumVal = strtod(NumStr.c_str(), nullptr);
@@ -45,7 +108,7 @@ int gettok() {
   if (LastChar == '#') {
     // Comment until end of line.
     do
-      LastChar = getchar();
+      LastChar = nextchar();
     while (LastChar != EOF and LastChar != '\n' and LastChar != '\r');
 
     if (LastChar != EOF)
@@ -58,7 +121,7 @@ int gettok() {
 
   // Otherwise, just return the character as its ascii value.
   int ThisChar = LastChar;
-  LastChar = getchar();
+  LastChar = nextchar();
   return ThisChar;
 }
 
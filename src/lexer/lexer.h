@@ -1,6 +1,7 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <cstddef>
 #include <string>
 
 namespace llvmpg {
@@ -24,9 +25,55 @@ enum Token : int {
 extern std::string IdentifierStr; // Filled in if tok_identifier
 extern double NumVal;             // Filled in if tok_number
 
-/// gettok - Return the next token from standard input.
+/// SourceLocation - A position in the lexer input; lines and columns count
+/// from 1.
+struct SourceLocation {
+  int Line;
+  int Col;
+};
+
+/// CurLoc - Where the token last returned by gettok starts.
+extern SourceLocation CurLoc;
+
+/// CurOffset - The byte offset in the string input (see SetLexerInput) of
+/// the token last returned by gettok; at the end, the length of the input.
+extern size_t CurOffset;
+
+/// SourceRange - The bytes [Begin, End) of a string input, starting at Loc.
+struct SourceRange {
+  size_t Begin;
+  size_t End;
+  SourceLocation Loc;
+};
+
+/// gettok - Return the next token from the lexer input.
 int gettok();
 
+/// SetLexerInput - Lex the string Source from its start, instead of standard
+/// input.  Start is the location reported for its first character.
+void SetLexerInput(const std::string &Source, SourceLocation Start = {1, 1});
+
+/// SetLexerStdin - Lex standard input again, from the next character on it.
+void SetLexerStdin();
+
+/// LexerState - The input of the lexer and its position in it.
+struct LexerState {
+  bool FromStdin;
+  std::string Source;
+  size_t SourcePos;
+  int LastChar;
+  SourceLocation LexLoc;
+  SourceLocation CurLoc;
+  size_t CurOffset;
+  std::string IdentifierStr;
+  double NumVal;
+};
+
+/// SaveLexerState/RestoreLexerState - Set the current input aside, to lex
+/// another in the middle of it, and resume it afterwards.
+LexerState SaveLexerState();
+void RestoreLexerState(LexerState &&State);
+
 } // namespace k
 } // namespace llvmpg
 
@@ -1,12 +1,392 @@
 #include <parser/parser.h>
+#include <algorithm>
 #include <cctype>
 #include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <unordered_map>
 
 namespace llvmpg {
 namespace k {
 
 namespace s = std;
 
+//===----------------------------------------------------------------------===//
+// AST Traversal
+//===----------------------------------------------------------------------===//
+
+unsigned NumChildren(const ExprAST &E) {
+  switch (E.Kind) {
+  case EK_Binary:
+    return 2;
+  case EK_Call:
+    return static_cast<const CallExprAST &>(E).Args.size();
+  case EK_Shared:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+ExprAST *GetChild(const ExprAST &E, unsigned I) {
+  switch (E.Kind) {
+  case EK_Binary: {
+    auto &B = static_cast<const BinaryExprAST &>(E);
+    return I == 0 ? B.LHS.get() : B.RHS.get();
+  }
+  case EK_Call:
+    return static_cast<const CallExprAST &>(E).Args[I].get();
+  case EK_Shared:
+    return static_cast<const SharedExprAST &>(E).Target->Node.get();
+  default:
+    return nullptr;
+  }
+}
+
+/// HashCombine - Mix V into the hash H.
+static uint64_t HashCombine(uint64_t H, uint64_t V) {
+  H ^= V + 0x9e3779b97f4a7c15ULL + (H << 6) + (H >> 2);
+  return H;
+}
+
+static uint64_t HashString(const s::string &Str) {
+  uint64_t H = 0xcbf29ce484222325ULL; // FNV-1a
+  for (unsigned char C : Str)
+    H = (H ^ C) * 0x100000001b3ULL;
+  return H;
+}
+
+uint64_t HashFunction(const FunctionAST &F) {
+  const PrototypeAST &Proto = *F.Proto;
+  uint64_t Result = HashCombine(HashString(Proto.Name), Proto.Args.size());
+  if (not F.Body)
+    return Result;
+
+  uint64_t H = 0;
+  PostOrder(H, *F.Body, [&Proto](uint64_t &Out, ExprAST &E, uint64_t *Ops, unsigned N) {
+    Out = E.Kind;
+    switch (E.Kind) {
+    case EK_Number: {
+      double Val = static_cast<NumberExprAST &>(E).Val;
+      uint64_t Bits;
+      memcpy(&Bits, &Val, sizeof(Bits));
+      Out = HashCombine(Out, Bits);
+      break;
+    }
+    case EK_Variable: {
+      // Parameters are identified by position, not by name.
+      const s::string &Name = static_cast<VariableExprAST &>(E).Name;
+      auto It = s::find(Proto.Args.begin(), Proto.Args.end(), Name);
+      Out = It == Proto.Args.end() ? HashCombine(Out, HashString(Name))
+                                   : HashCombine(Out, It - Proto.Args.begin());
+      break;
+    }
+    case EK_Binary:
+      Out = HashCombine(Out, static_cast<BinaryExprAST &>(E).Op);
+      break;
+    case EK_Call:
+      Out = HashCombine(Out, HashString(static_cast<CallExprAST &>(E).Callee));
+      break;
+    case EK_Shared:
+      // Sharing does not change the meaning.
+      Out = Ops[0];
+      return true;
+    }
+    for (unsigned i = 0; i != N; ++i)
+      Out = HashCombine(Out, Ops[i]);
+    return true;
+  });
+  return HashCombine(Result, H);
+}
+
+bool SameFunction(const FunctionAST &A, const FunctionAST &B) {
+  const PrototypeAST &PA = *A.Proto, &PB = *B.Proto;
+  if (PA.Name != PB.Name or PA.Args.size() != PB.Args.size())
+    return false;
+  if (not A.Body or not B.Body)
+    return not A.Body and not B.Body;
+
+  // Parameters are identified by position, not by name.
+  auto Position = [](const PrototypeAST &Proto, const s::string &Name) {
+    return size_t(s::find(Proto.Args.begin(), Proto.Args.end(), Name) - Proto.Args.begin());
+  };
+  s::vector<s::pair<const ExprAST *, const ExprAST *>> Work{{A.Body.get(), B.Body.get()}};
+  while (not Work.empty()) {
+    const ExprAST *X = Work.back().first, *Y = Work.back().second;
+    Work.pop_back();
+    // Sharing does not change the meaning.
+    while (X->Kind == EK_Shared)
+      X = GetChild(*X, 0);
+    while (Y->Kind == EK_Shared)
+      Y = GetChild(*Y, 0);
+    if (X->Kind != Y->Kind)
+      return false;
+
+    switch (X->Kind) {
+    case EK_Number: {
+      double XVal = static_cast<const NumberExprAST *>(X)->Val;
+      double YVal = static_cast<const NumberExprAST *>(Y)->Val;
+      if (memcmp(&XVal, &YVal, sizeof(XVal)))
+        return false;
+      break;
+    }
+    case EK_Variable: {
+      const s::string &XName = static_cast<const VariableExprAST *>(X)->Name;
+      const s::string &YName = static_cast<const VariableExprAST *>(Y)->Name;
+      auto XAt = Position(PA, XName), YAt = Position(PB, YName);
+      if (XAt != YAt or (XAt == PA.Args.size() and XName != YName))
+        return false;
+      break;
+    }
+    case EK_Binary:
+      if (static_cast<const BinaryExprAST *>(X)->Op != static_cast<const BinaryExprAST *>(Y)->Op)
+        return false;
+      break;
+    case EK_Call: {
+      auto *XCall = static_cast<const CallExprAST *>(X);
+      auto *YCall = static_cast<const CallExprAST *>(Y);
+      if (XCall->Callee != YCall->Callee or XCall->Args.size() != YCall->Args.size())
+        return false;
+      break;
+    }
+    default:
+      break;
+    }
+    for (unsigned i = 0, e = NumChildren(*X); i != e; ++i)
+      Work.push_back({GetChild(*X, i), GetChild(*Y, i)});
+  }
+  return true;
+}
+
+/// DetachChildren - Move the subtrees owned by E to Out.
+static void DetachChildren(s::vector<s::unique_ptr<ExprAST>> &Out, ExprAST &E) {
+  switch (E.Kind) {
+  case EK_Binary: {
+    auto &B = static_cast<BinaryExprAST &>(E);
+    if (B.LHS)
+      Out.push_back(s::move(B.LHS));
+    if (B.RHS)
+      Out.push_back(s::move(B.RHS));
+    break;
+  }
+  case EK_Call:
+    for (auto &Arg : static_cast<CallExprAST &>(E).Args)
+      if (Arg)
+        Out.push_back(s::move(Arg));
+    break;
+  default:
+    break;
+  }
+}
+
+/// DestroyChildren - Free the subtrees of E without recursing: every node is
+/// stripped of its children before it is deleted.
+static void DestroyChildren(ExprAST &E) {
+  s::vector<s::unique_ptr<ExprAST>> Work;
+  DetachChildren(Work, E);
+  while (not Work.empty()) {
+    s::unique_ptr<ExprAST> Node = s::move(Work.back());
+    Work.pop_back();
+    DetachChildren(Work, *Node);
+  }
+}
+
+BinaryExprAST::~BinaryExprAST() { DestroyChildren(*this); }
+CallExprAST::~CallExprAST() { DestroyChildren(*this); }
+
+//===----------------------------------------------------------------------===//
+// AST Factory
+//===----------------------------------------------------------------------===//
+
+static s::unique_ptr<ExprAST> CreateNumberExpr(double Val) {
+  return s::make_unique<NumberExprAST>(Val);
+}
+
+static s::unique_ptr<ExprAST> CreateVariableExpr(const s::string &Name) {
+  return s::make_unique<VariableExprAST>(Name);
+}
+
+static s::unique_ptr<ExprAST> CreateBinaryExpr(char Op, s::unique_ptr<ExprAST> LHS,
+                                               s::unique_ptr<ExprAST> RHS) {
+  return s::make_unique<BinaryExprAST>(Op, s::move(LHS), s::move(RHS));
+}
+
+static s::unique_ptr<ExprAST> CreateCallExpr(const s::string &Callee,
+                                             s::vector<s::unique_ptr<ExprAST>> Args) {
+  return s::make_unique<CallExprAST>(Callee, s::move(Args));
+}
+
+static s::unique_ptr<PrototypeAST> CreatePrototype(const s::string &Name,
+                                                   s::vector<s::string> Args) {
+  return s::make_unique<PrototypeAST>(Name, s::move(Args));
+}
+
+static s::unique_ptr<FunctionAST> CreateFunction(s::unique_ptr<PrototypeAST> Proto,
+                                                 s::unique_ptr<ExprAST> Body) {
+  return s::make_unique<FunctionAST>(s::move(Proto), s::move(Body));
+}
+
+static s::unique_ptr<ExprAST> CreateSharedExpr(SharedNode *Target) {
+  return s::make_unique<SharedExprAST>(Target);
+}
+
+const ASTFactory DefaultFactory = {
+    CreateNumberExpr, CreateVariableExpr, CreateBinaryExpr, CreateCallExpr,
+    CreatePrototype,  CreateFunction,     CreateSharedExpr,
+};
+
+ASTFactory Factory = DefaultFactory;
+
+s::unique_ptr<FunctionAST> CloneFunction(const FunctionAST &F) {
+  s::unique_ptr<ExprAST> Body;
+  if (F.Body)
+    PostOrder(Body, *F.Body,
+              [](s::unique_ptr<ExprAST> &Out, ExprAST &E, s::unique_ptr<ExprAST> *Ops,
+                 unsigned N) {
+      switch (E.Kind) {
+      case EK_Number:
+        Out = Factory.Number(static_cast<NumberExprAST &>(E).Val);
+        break;
+      case EK_Variable:
+        Out = Factory.Variable(static_cast<VariableExprAST &>(E).Name);
+        break;
+      case EK_Binary:
+        Out = Factory.Binary(static_cast<BinaryExprAST &>(E).Op, s::move(Ops[0]),
+                             s::move(Ops[1]));
+        break;
+      case EK_Call:
+        Out = Factory.Call(static_cast<CallExprAST &>(E).Callee,
+                           s::vector<s::unique_ptr<ExprAST>>(
+                               s::make_move_iterator(Ops), s::make_move_iterator(Ops + N)));
+        break;
+      case EK_Shared:
+        Out = s::move(Ops[0]);
+        return true;
+      }
+      Out->Loc = E.Loc;
+      return true;
+    });
+
+  auto Proto = Factory.Prototype(F.Proto->Name, F.Proto->Args);
+  Proto->Line = F.Proto->Line;
+  return Factory.Function(s::move(Proto), s::move(Body));
+}
+
+//===----------------------------------------------------------------------===//
+// Hash Consing
+//===----------------------------------------------------------------------===//
+
+// The factory interned nodes are built with, and the nodes interned for the
+// function being parsed, keyed by their kind, payload and the identity of
+// their (interned) operands.
+static ASTFactory HashConsBase = DefaultFactory;
+static s::unordered_map<s::string, s::unique_ptr<SharedNode>> HashConsTable;
+
+/// AppendKey - Append the bytes of V to Key.
+template <typename T>
+static void AppendKey(s::string &Key, const T &V) {
+  Key.append(reinterpret_cast<const char *>(&V), sizeof(V));
+}
+
+/// InternOperand - The interned node an operand refers to.  Operands built
+/// by another factory are interned as they are, without sharing, and E is
+/// replaced by a reference.
+static SharedNode *InternOperand(s::unique_ptr<ExprAST> &E) {
+  if (E->Kind == EK_Shared)
+    return static_cast<SharedExprAST &>(*E).Target;
+  s::string Key = "u";
+  AppendKey(Key, E.get());
+  auto &N = HashConsTable[Key];
+  N = s::make_unique<SharedNode>();
+  N->Node = s::move(E);
+  N->Uses = 1;
+  E = HashConsBase.Shared(N.get());
+  E->Loc = N->Node->Loc;
+  return N.get();
+}
+
+/// Intern - A reference to the node for Key, building it with Make the first
+/// time Key is seen.
+template <typename MakeFn>
+static s::unique_ptr<ExprAST> Intern(const s::string &Key, MakeFn &&Make) {
+  auto &N = HashConsTable[Key];
+  if (not N) {
+    N = s::make_unique<SharedNode>();
+    N->Node = Make();
+    // Only the parser interns nodes.
+    N->Node->Loc = CurLoc;
+  }
+  ++N->Uses;
+  auto E = HashConsBase.Shared(N.get());
+  E->Loc = N->Node->Loc;
+  return E;
+}
+
+static s::unique_ptr<ExprAST> CreateHashConsNumber(double Val) {
+  s::string Key(1, static_cast<char>(EK_Number));
+  AppendKey(Key, Val);
+  return Intern(Key, [Val]() { return HashConsBase.Number(Val); });
+}
+
+static s::unique_ptr<ExprAST> CreateHashConsVariable(const s::string &Name) {
+  s::string Key = static_cast<char>(EK_Variable) + Name;
+  return Intern(Key, [&Name]() { return HashConsBase.Variable(Name); });
+}
+
+static s::unique_ptr<ExprAST> CreateHashConsBinary(char Op, s::unique_ptr<ExprAST> LHS,
+                                                   s::unique_ptr<ExprAST> RHS) {
+  s::string Key{static_cast<char>(EK_Binary), Op};
+  AppendKey(Key, InternOperand(LHS));
+  AppendKey(Key, InternOperand(RHS));
+  return Intern(Key, [&]() {
+    return HashConsBase.Binary(Op, s::move(LHS), s::move(RHS));
+  });
+}
+
+static s::unique_ptr<ExprAST> CreateHashConsCall(const s::string &Callee,
+                                                 s::vector<s::unique_ptr<ExprAST>> Args) {
+  s::string Key(1, static_cast<char>(EK_Call));
+  AppendKey(Key, Args.size());
+  for (auto &Arg : Args)
+    AppendKey(Key, InternOperand(Arg));
+  Key += Callee;
+  return Intern(Key, [&]() { return HashConsBase.Call(Callee, s::move(Args)); });
+}
+
+static s::unique_ptr<PrototypeAST> CreateHashConsPrototype(const s::string &Name,
+                                                           s::vector<s::string> Args) {
+  return HashConsBase.Prototype(Name, s::move(Args));
+}
+
+static s::unique_ptr<FunctionAST> CreateHashConsFunction(s::unique_ptr<PrototypeAST> Proto,
+                                                         s::unique_ptr<ExprAST> Body) {
+  // The function takes the table along: what was interned for it is shared
+  // with nothing else.
+  auto F = HashConsBase.Function(s::move(Proto), s::move(Body));
+  for (auto &KV : HashConsTable)
+    F->Shared.push_back(s::move(KV.second));
+  HashConsTable.clear();
+  return F;
+}
+
+static s::unique_ptr<ExprAST> CreateHashConsShared(SharedNode *Target) {
+  return HashConsBase.Shared(Target);
+}
+
+ASTFactory MakeHashConsFactory(const ASTFactory &Base) {
+  HashConsBase = Base;
+  return {
+      CreateHashConsNumber,    CreateHashConsVariable, CreateHashConsBinary,
+      CreateHashConsCall,      CreateHashConsPrototype, CreateHashConsFunction,
+      CreateHashConsShared,
+  };
+}
+
+size_t HashConsTableSize() { return HashConsTable.size(); }
+
+/// DiscardHashCons - Drop what was interned for an item that failed to parse.
+static void DiscardHashCons() { HashConsTable.clear(); }
+
 //===----------------------------------------------------------------------===//
 // Parser
 //===----------------------------------------------------------------------===//
@@ -33,6 +413,8 @@ int GetTokPrecedence() {
   return TokPrec;
 }
 
+unsigned MaxNestingDepth = 0;
+
 /// LogError* - These are little helper functions for error handling.
 s::unique_ptr<ExprAST> LogError(const char *Str) {
   fprintf(stderr, "Error: %s\n", Str);
@@ -43,11 +425,17 @@ s::unique_ptr<PrototypeAST> LogErrorP(const char *Str) {
   return nullptr;
 }
 
+/// WithLoc - Set the source location of a node made by the parser.
+static s::unique_ptr<ExprAST> WithLoc(s::unique_ptr<ExprAST> E, SourceLocation Loc) {
+  E->Loc = Loc;
+  return E;
+}
+
 /// numberexpr ::= number
 s::unique_ptr<ExprAST> ParseNumberExpr() {
-  auto Result = s::make_unique<NumberExprAST>(NumVal);
+  auto Result = WithLoc(Factory.Number(NumVal), CurLoc);
   getNextToken(); // consume the number
-  return s::move(Result);
+  return Result;
 }
 
 /// parenexpr ::= '(' expression ')'
@@ -68,11 +456,12 @@ s::unique_ptr<ExprAST> ParseParenExpr() {
 ///   ::= identifier '(' expression* ')'
 s::unique_ptr<ExprAST> ParseIdentifierExpr() {
   s::string IdName = IdentifierStr;
+  SourceLocation IdLoc = CurLoc;
 
   getNextToken(); // eat identifier.
 
   if (CurTok != '(') // Simple variable ref.
-    return s::make_unique<VariableExprAST>(IdName);
+    return WithLoc(Factory.Variable(IdName), IdLoc);
 
   // Call.
   getNextToken(); // eat (
@@ -96,7 +485,7 @@ s::unique_ptr<ExprAST> ParseIdentifierExpr() {
   // Eat the ')'.
   getNextToken();
 
-  return s::make_unique<CallExprAST>(IdName, s::move(Args));
+  return WithLoc(Factory.Call(IdName, s::move(Args)), IdLoc);
 }
 
 /// primary
@@ -116,51 +505,163 @@ s::unique_ptr<ExprAST> ParsePrimary() {
   }
 }
 
-/// binoprhs
-///   ::= ('+' primary)*
-s::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,
-                                     s::unique_ptr<ExprAST> LHS) {
-  // If this is a binop, find its precedence.
+/// ExprFrame - A construct left open while parsing an expression: a binary
+/// operator waiting for its right operand, a '(' or a call waiting for ')'.
+struct ExprFrame {
+  enum FrameKind : int {
+    FK_BinOp = 0,
+    FK_Paren = 1,
+    FK_Call = 2,
+  };
+
+  FrameKind Kind = FK_BinOp;
+  int Op = 0;            // FK_BinOp: the operator
+  int Prec = 0;          // FK_BinOp: its precedence
+  s::string Callee{};    // FK_Call: the function called
+  size_t ArgBase = 0;    // FK_Call: operand stack index of the first argument
+  SourceLocation Loc{};  // FK_BinOp/FK_Call: the operator or the callee
+};
+
+/// ParseOperatorPrecedence - Parse an expression with explicit operand and
+/// operator stacks rather than recursion, so nesting is bounded only by
+/// memory (and MaxNestingDepth).  If LHS is given it is the first operand.
+/// Outside any parentheses, only operators binding at least as tightly as
+/// ExprPrec are consumed.
+static s::unique_ptr<ExprAST> ParseOperatorPrecedence(int ExprPrec,
+                                                      s::unique_ptr<ExprAST> LHS) {
+  s::vector<s::unique_ptr<ExprAST>> Operands;
+  s::vector<ExprFrame> Frames;
+  unsigned Depth = 0; // open parentheses and calls
+  bool ExpectOperand = true;
+  if (LHS) {
+    Operands.push_back(s::move(LHS));
+    ExpectOperand = false;
+  }
+
+  // Merge the top two operands with the innermost pending operator.
+  auto Reduce = [&Operands, &Frames]() {
+    auto RHS = s::move(Operands.back());
+    Operands.pop_back();
+    auto L = s::move(Operands.back());
+    Operands.pop_back();
+    Operands.push_back(WithLoc(Factory.Binary(Frames.back().Op, s::move(L), s::move(RHS)),
+                               Frames.back().Loc));
+    Frames.pop_back();
+  };
+  auto Open = [&Frames, &Depth](ExprFrame F) {
+    if (MaxNestingDepth and Depth == MaxNestingDepth)
+      return false;
+    ++Depth;
+    Frames.push_back(s::move(F));
+    return true;
+  };
+
   while (true) {
-    int TokPrec = GetTokPrecedence();
+    if (ExpectOperand) {
+      // primary ::= identifier | identifier '(' ... | number | '(' ...
+      switch (CurTok) {
+      default:
+        return LogError("unknown token when expecting an expression");
+      case tok_number:
+        Operands.push_back(WithLoc(Factory.Number(NumVal), CurLoc));
+        getNextToken(); // consume the number
+        ExpectOperand = false;
+        break;
+      case tok_identifier: {
+        s::string IdName = IdentifierStr;
+        SourceLocation IdLoc = CurLoc;
+        getNextToken(); // eat identifier.
+        if (CurTok != '(') { // Simple variable ref.
+          Operands.push_back(WithLoc(Factory.Variable(IdName), IdLoc));
+          ExpectOperand = false;
+          break;
+        }
+        getNextToken(); // eat (
+        if (CurTok == ')') {
+          getNextToken(); // eat ).
+          Operands.push_back(WithLoc(Factory.Call(IdName, {}), IdLoc));
+          ExpectOperand = false;
+          break;
+        }
+        ExprFrame F{ExprFrame::FK_Call};
+        F.Callee = IdName;
+        F.ArgBase = Operands.size();
+        F.Loc = IdLoc;
+        if (not Open(s::move(F)))
+          return LogError("expression nested too deeply");
+        break;
+      }
+      case '(':
+        getNextToken(); // eat (.
+        if (not Open(ExprFrame{ExprFrame::FK_Paren}))
+          return LogError("expression nested too deeply");
+        break;
+      }
+      continue;
+    }
 
-    // If this is a binop that binds at least as tightly as the current binop,
-    // consume it, otherwise we are done.
-    if (TokPrec < ExprPrec)
-      return LHS;
-
-    // Okay, we know this is a binop.
-    int BinOp = CurTok;
-    getNextToken(); // eat binop
-
-    // Parse the primary expression after the binary operator.
-    auto RHS = ParsePrimary();
-    if (not RHS)
-      return nullptr;
-
-    // If BinOp binds less tightly with RHS than the operator after RHS, let
-    // the pending operator take RHS as its LHS.
-    int NextPrec = GetTokPrecedence();
-    if (TokPrec < NextPrec) {
-      RHS = ParseBinOpRHS(TokPrec + 1, s::move(RHS));
-      if (not RHS)
-        return nullptr;
+    // binoprhs ::= (binop primary)*
+    // Pending operators that bind at least as tightly as this one take their
+    // operands first, which makes operators left associative.
+    int TokPrec = GetTokPrecedence();
+    if (TokPrec >= (Depth ? 0 : ExprPrec)) {
+      while (not Frames.empty() and Frames.back().Kind == ExprFrame::FK_BinOp and
+             Frames.back().Prec >= TokPrec)
+        Reduce();
+      ExprFrame F{ExprFrame::FK_BinOp};
+      F.Op = CurTok;
+      F.Prec = TokPrec;
+      F.Loc = CurLoc;
+      Frames.push_back(F);
+      getNextToken(); // eat binop
+      ExpectOperand = true;
+      continue;
     }
 
-    // Merge LHS/RHS.
-    LHS = s::make_unique<BinaryExprAST>(BinOp, s::move(LHS), s::move(RHS));
+    // Not an operator: the innermost open construct ends here.
+    while (not Frames.empty() and Frames.back().Kind == ExprFrame::FK_BinOp)
+      Reduce();
+    if (Frames.empty())
+      return s::move(Operands.back());
+
+    ExprFrame &G = Frames.back();
+    if (G.Kind == ExprFrame::FK_Paren) {
+      if (CurTok != ')')
+        return LogError("expected ')'");
+      getNextToken(); // eat ).
+    } else {
+      if (CurTok == ',') {
+        getNextToken();
+        ExpectOperand = true;
+        continue;
+      }
+      if (CurTok != ')')
+        return LogError("Expected ')' or ',' in argument list");
+      getNextToken(); // eat ).
+
+      s::vector<s::unique_ptr<ExprAST>> Args;
+      for (size_t i = G.ArgBase, e = Operands.size(); i != e; ++i)
+        Args.push_back(s::move(Operands[i]));
+      Operands.resize(G.ArgBase);
+      Operands.push_back(WithLoc(Factory.Call(G.Callee, s::move(Args)), G.Loc));
+    }
+    Frames.pop_back();
+    --Depth;
   }
 }
 
+/// binoprhs
+///   ::= ('+' primary)*
+s::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,
+                                     s::unique_ptr<ExprAST> LHS) {
+  return ParseOperatorPrecedence(ExprPrec, s::move(LHS));
+}
+
 /// expression
 ///   ::= primary binoprhs
 ///
 s::unique_ptr<ExprAST> ParseExpression() {
-  auto LHS = ParsePrimary();
-  if (not LHS)
-    return nullptr;
-
-  return ParseBinOpRHS(0, s::move(LHS));
+  return ParseOperatorPrecedence(0, nullptr);
 }
 
 /// prototype
@@ -170,6 +671,7 @@ s::unique_ptr<PrototypeAST> ParsePrototype() {
     return LogErrorP("Expected function name in prototype");
 
   s::string FnName = IdentifierStr;
+  int FnLine = CurLoc.Line;
   getNextToken();
 
   if (CurTok != '(')
@@ -184,28 +686,116 @@ s::unique_ptr<PrototypeAST> ParsePrototype() {
   // success.
   getNextToken(); // eat ')'.
 
-  return s::make_unique<PrototypeAST>(FnName, s::move(ArgNames));
+  auto Proto = Factory.Prototype(FnName, s::move(ArgNames));
+  Proto->Line = FnLine;
+  return Proto;
 }
 
 /// definition ::= 'def' prototype expression
 s::unique_ptr<FunctionAST> ParseDefinition() {
+  DiscardHashCons();
   getNextToken(); // eat def.
   auto Proto = ParsePrototype();
   if (not Proto)
     return nullptr;
 
   if (auto E = ParseExpression())
-    return s::make_unique<FunctionAST>(s::move(Proto), s::move(E));
+    return Factory.Function(s::move(Proto), s::move(E));
   return nullptr;
 }
 
+/// SkimExpression - Step over the tokens of an expression without building
+/// it.  Only the bracketing and the alternation of operands and operators are
+/// checked; anything else is reported when the expression is parsed.
+static bool SkimExpression() {
+  unsigned Depth = 0; // open parentheses and argument lists
+  bool ExpectOperand = true;
+  while (true) {
+    if (ExpectOperand) {
+      switch (CurTok) {
+      case '(':
+        ++Depth;
+        getNextToken();
+        continue;
+      case tok_number:
+        getNextToken();
+        ExpectOperand = false;
+        continue;
+      case tok_identifier:
+        if (getNextToken() != '(') {
+          ExpectOperand = false;
+          continue;
+        }
+        ++Depth;
+        if (getNextToken() == ')') { // no arguments
+          --Depth;
+          getNextToken();
+          ExpectOperand = false;
+        }
+        continue;
+      default:
+        LogError("unknown token when expecting an expression");
+        return false;
+      }
+    }
+
+    if (GetTokPrecedence() > 0) {
+      getNextToken();
+      ExpectOperand = true;
+    } else if (Depth and CurTok == ')') {
+      --Depth;
+      getNextToken();
+    } else if (Depth and CurTok == ',') {
+      getNextToken();
+      ExpectOperand = true;
+    } else if (Depth) {
+      LogError("expected ')'");
+      return false;
+    } else {
+      return true;
+    }
+  }
+}
+
+s::unique_ptr<PrototypeAST> SkimDefinition(SourceRange &Body) {
+  getNextToken(); // eat def.
+  auto Proto = ParsePrototype();
+  if (not Proto)
+    return nullptr;
+
+  Body.Begin = CurOffset;
+  Body.Loc = CurLoc;
+  if (not SkimExpression())
+    return nullptr;
+  Body.End = CurOffset;
+  return Proto;
+}
+
+s::unique_ptr<ExprAST> ParseSkimmedBody(const s::string &Source, const SourceRange &Body) {
+  DiscardHashCons();
+  LexerState Outer = SaveLexerState();
+  int OuterTok = CurTok;
+
+  SetLexerInput(Source.substr(Body.Begin, Body.End - Body.Begin), Body.Loc);
+  getNextToken();
+  auto E = ParseExpression();
+  if (E and CurTok != tok_eof)
+    E = LogError("Unexpected token after expression");
+
+  RestoreLexerState(s::move(Outer));
+  CurTok = OuterTok;
+  return E;
+}
+
 /// toplevelexpr ::= expression
-s::unique_ptr<FunctionAST> ParseTopLevelExpr() {
+s::unique_ptr<FunctionAST> ParseTopLevelExpr(const s::string &Name) {
+  DiscardHashCons();
+  int ExprLine = CurLoc.Line;
   if (auto E = ParseExpression()) {
     // Make an anonymous proto.
-    auto Proto = s::make_unique<PrototypeAST>("__anon_expr",
-                                              s::vector<s::string>());
-    return s::make_unique<FunctionAST>(s::move(Proto), s::move(E));
+    auto Proto = Factory.Prototype(Name, s::vector<s::string>());
+    Proto->Line = ExprLine;
+    return Factory.Function(s::move(Proto), s::move(E));
   }
   return nullptr;
 }
@@ -216,5 +806,31 @@ s::unique_ptr<PrototypeAST> ParseExtern() {
   return ParsePrototype();
 }
 
+TopLevelItem ParseTopLevelItem(const s::function<s::string()> &ExprName) {
+  TopLevelItem Item;
+  while (CurTok == ';') // ignore top-level semicolons.
+    getNextToken();
+  switch (CurTok) {
+  case tok_eof:
+    return Item;
+  case tok_def:
+    Item.Kind = IK_Definition;
+    Item.Function = ParseDefinition();
+    break;
+  case tok_extern:
+    Item.Kind = IK_Extern;
+    Item.Proto = ParseExtern();
+    break;
+  default:
+    Item.Kind = IK_Expression;
+    Item.Function = ParseTopLevelExpr(ExprName());
+    break;
+  }
+  // Skip token for error recovery.
+  if (not Item.Function and not Item.Proto)
+    getNextToken();
+  return Item;
+}
+
 } // namespace k
 } // namespace llvmpg
\ No newline at end of file
@@ -2,6 +2,9 @@
 #define PARSER_H
 
 #include <lexer/lexer.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
@@ -21,8 +24,25 @@ namespace s = std;
 // Abstract Syntax Tree (aka Parse Tree)
 //===----------------------------------------------------------------------===//
 
-/// ExprAST - Base class for all expression nodes.
+/// ExprKind - Discriminator for the expression nodes, so that passes over the
+/// tree can switch on the node type.
+enum ExprKind : int {
+  EK_Number = 0,
+  EK_Variable = 1,
+  EK_Binary = 2,
+  EK_Call = 3,
+  EK_Shared = 4,
+};
+
+/// ExprAST - Base class for all expression nodes.  Loc is where the node
+/// starts in the source (for a binary operator, the operator itself), set by
+/// whoever builds the node: nodes are also built off the parser thread, so
+/// they must not read the lexer state.
 struct ExprAST {
+  ExprKind Kind;
+  SourceLocation Loc{};
+
+  ExprAST(ExprKind Kind) : Kind(Kind) {}
   virtual ~ExprAST() = default;
   virtual llvm::Value *codegen() { return nullptr; }
 };
@@ -31,7 +51,7 @@ struct ExprAST {
 struct NumberExprAST : public ExprAST {
   double Val;
 
-  NumberExprAST(double Val) : Val(Val) {}
+  NumberExprAST(double Val) : ExprAST(EK_Number), Val(Val) {}
   llvm::Value *codegen() override { return nullptr; }
 };
 
@@ -39,7 +59,8 @@ struct NumberExprAST : public ExprAST {
 struct VariableExprAST : public ExprAST {
   s::string Name;
 
-  VariableExprAST(const s::string &Name) : Name(Name) {}
+  VariableExprAST(const s::string &Name)
+      : ExprAST(EK_Variable), Name(Name) {}
   llvm::Value *codegen() override { return nullptr; }
 };
 
@@ -50,7 +71,9 @@ struct BinaryExprAST : public ExprAST {
 
   BinaryExprAST(char Op, s::unique_ptr<ExprAST> LHS,
                 s::unique_ptr<ExprAST> RHS)
-      : Op(Op), LHS(s::move(LHS)), RHS(s::move(RHS)) {}
+      : ExprAST(EK_Binary), Op(Op), LHS(s::move(LHS)),
+        RHS(s::move(RHS)) {}
+  ~BinaryExprAST() override;
   llvm::Value *codegen() override { return nullptr; }
 };
 
@@ -61,7 +84,26 @@ struct CallExprAST : public ExprAST {
 
   CallExprAST(const s::string &Callee,
               s::vector<s::unique_ptr<ExprAST>> Args)
-      : Callee(Callee), Args(s::move(Args)) {}
+      : ExprAST(EK_Call), Callee(Callee), Args(s::move(Args)) {}
+  ~CallExprAST() override;
+  llvm::Value *codegen() override { return nullptr; }
+};
+
+/// SharedNode - A subtree interned by the hash-consing builder, owned by the
+/// function it was built for.  Uses counts the references handed out within
+/// that function (an upper bound, as references are not counted down when
+/// freed).
+struct SharedNode {
+  s::unique_ptr<ExprAST> Node;
+  unsigned Uses = 0;
+};
+
+/// SharedExprAST - Expression class for a reference to an interned subtree.
+/// Any number of references share the subtree; it is not owned by them.
+struct SharedExprAST : public ExprAST {
+  SharedNode *Target;
+
+  SharedExprAST(SharedNode *Target) : ExprAST(EK_Shared), Target(Target) {}
   llvm::Value *codegen() override { return nullptr; }
 };
 
@@ -71,6 +113,7 @@ struct CallExprAST : public ExprAST {
 struct PrototypeAST {
   s::string Name;
   s::vector<s::string> Args;
+  int Line = 0; // line the definition starts on, set by the parser
 
   PrototypeAST(const s::string &Name, s::vector<s::string> Args)
       : Name(Name), Args(s::move(Args)) {}
@@ -83,6 +126,7 @@ struct PrototypeAST {
 struct FunctionAST {
   s::unique_ptr<PrototypeAST> Proto;
   s::unique_ptr<ExprAST> Body;
+  s::vector<s::unique_ptr<SharedNode>> Shared; // interned subtrees of Body
 
   FunctionAST(s::unique_ptr<PrototypeAST> Proto,
               s::unique_ptr<ExprAST> Body)
@@ -90,6 +134,113 @@ struct FunctionAST {
   virtual llvm::Function *codegen() { return nullptr; }
 };
 
+//===----------------------------------------------------------------------===//
+// AST Traversal
+//===----------------------------------------------------------------------===//
+
+// Trees may be far deeper than the C++ stack allows recursion (e.g. long
+// operator chains), so every walk over them uses an explicit stack.
+
+/// NumChildren/GetChild - The operands of E, in evaluation order.
+unsigned NumChildren(const ExprAST &E);
+ExprAST *GetChild(const ExprAST &E, unsigned I);
+
+/// PostOrder - Compute a value of type T for every node under Root, children
+/// before their parent.  Visit(Out, E, Operands, NumOperands) gets the values
+/// of E's children and stores E's value in Out; returning false stops the
+/// walk.  On success Result is the value of Root.  If Known(Out, E) returns
+/// true, E's value is Out and its subtree is not walked (e.g. a shared
+/// subtree whose value is already computed).
+template <typename T, typename KnownFn, typename VisitFn>
+bool PostOrder(T &Result, ExprAST &Root, KnownFn &&Known, VisitFn &&Visit) {
+  struct Frame {
+    ExprAST *E;
+    unsigned Next; // next child to visit
+  };
+  s::vector<Frame> Stack;
+  s::vector<T> Values;
+  if (Known(Result, Root))
+    return true;
+  Stack.push_back({&Root, 0});
+  while (not Stack.empty()) {
+    Frame &F = Stack.back();
+    unsigned N = NumChildren(*F.E);
+    if (F.Next < N) {
+      ExprAST *Child = GetChild(*F.E, F.Next++);
+      T ChildOut{};
+      if (Known(ChildOut, *Child))
+        Values.push_back(s::move(ChildOut));
+      else
+        Stack.push_back({Child, 0});
+      continue;
+    }
+
+    T Out{};
+    if (not Visit(Out, *F.E, Values.data() + Values.size() - N, N))
+      return false;
+    Values.resize(Values.size() - N);
+    Values.push_back(s::move(Out));
+    Stack.pop_back();
+  }
+  Result = s::move(Values.back());
+  return true;
+}
+
+template <typename T, typename VisitFn>
+bool PostOrder(T &Result, ExprAST &Root, VisitFn &&Visit) {
+  return PostOrder(Result, Root, [](T &, ExprAST &) { return false; },
+                   s::forward<VisitFn>(Visit));
+}
+
+/// HashFunction - Structural hash of the definition F.  Definitions that
+/// differ only in layout, comments or the names of their parameters hash
+/// alike.
+uint64_t HashFunction(const FunctionAST &F);
+
+/// SameFunction - Whether A and B are the same definition up to what
+/// HashFunction ignores, to tell a real match from a hash collision.
+bool SameFunction(const FunctionAST &A, const FunctionAST &B);
+
+//===----------------------------------------------------------------------===//
+// AST Factory
+//===----------------------------------------------------------------------===//
+
+/// ASTFactory - Constructors for the nodes the parser builds.  The default
+/// builds the plain AST nodes above; other libraries install their own node
+/// types (such as the codegen nodes) by assigning Factory.
+struct ASTFactory {
+  s::unique_ptr<ExprAST> (*Number)(double Val);
+  s::unique_ptr<ExprAST> (*Variable)(const s::string &Name);
+  s::unique_ptr<ExprAST> (*Binary)(char Op, s::unique_ptr<ExprAST> LHS,
+                                   s::unique_ptr<ExprAST> RHS);
+  s::unique_ptr<ExprAST> (*Call)(const s::string &Callee,
+                                 s::vector<s::unique_ptr<ExprAST>> Args);
+  s::unique_ptr<PrototypeAST> (*Prototype)(const s::string &Name,
+                                           s::vector<s::string> Args);
+  s::unique_ptr<FunctionAST> (*Function)(s::unique_ptr<PrototypeAST> Proto,
+                                         s::unique_ptr<ExprAST> Body);
+  s::unique_ptr<ExprAST> (*Shared)(SharedNode *Target);
+};
+
+extern const ASTFactory DefaultFactory;
+extern ASTFactory Factory;
+
+/// CloneFunction - A deep copy of F built with Factory, keeping the source
+/// locations.  Shared subtrees are copied like any other.
+s::unique_ptr<FunctionAST> CloneFunction(const FunctionAST &F);
+
+/// MakeHashConsFactory - A builder that interns expressions: structurally
+/// identical subtrees of one function are built once with Base, and every
+/// occurrence becomes a SharedExprAST referring to them.  The table is
+/// handed to the function when it is built (FunctionAST::Shared), so
+/// subtrees are never shared across functions and it is empty again for the
+/// next one.
+ASTFactory MakeHashConsFactory(const ASTFactory &Base);
+
+/// HashConsTableSize - Number of distinct subtrees interned for the function
+/// being parsed.
+size_t HashConsTableSize();
+
 //===----------------------------------------------------------------------===//
 // Parser
 //===----------------------------------------------------------------------===//
@@ -107,6 +258,10 @@ extern s::map<char, int> BinopPrecedence;
 /// GetTokPrecedence - Get the precedence of the pending binary operator token.
 int GetTokPrecedence();
 
+/// MaxNestingDepth - Limit on parentheses and calls nested in one expression,
+/// reported as a parse error.  Zero means no limit besides memory.
+extern unsigned MaxNestingDepth;
+
 /// LogError* - These are little helper functions for error handling.
 s::unique_ptr<ExprAST> LogError(const char *Str);
 s::unique_ptr<PrototypeAST> LogErrorP(const char *Str);
@@ -119,9 +274,41 @@ s::unique_ptr<ExprAST> ParsePrimary();
 s::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec, s::unique_ptr<ExprAST> LHS);
 s::unique_ptr<PrototypeAST> ParsePrototype();
 s::unique_ptr<FunctionAST> ParseDefinition();
-s::unique_ptr<FunctionAST> ParseTopLevelExpr();
+s::unique_ptr<FunctionAST> ParseTopLevelExpr(const s::string &Name = "__anon_expr");
 s::unique_ptr<PrototypeAST> ParseExtern();
 
+/// ItemKind - What a top-level item is.
+enum ItemKind : int {
+  IK_End = 0,
+  IK_Definition = 1,
+  IK_Extern = 2,
+  IK_Expression = 3,
+};
+
+/// TopLevelItem - One parsed top-level item.  Both Function and Proto are
+/// null if it failed to parse.
+struct TopLevelItem {
+  ItemKind Kind = IK_End;
+  s::unique_ptr<FunctionAST> Function; // a definition or an expression
+  s::unique_ptr<PrototypeAST> Proto;   // an extern
+};
+
+/// ParseTopLevelItem - Parse the next item, skipping top-level semicolons
+/// before it and a token after an error.  An expression is named
+/// ExprName().  Returns an IK_End item at the end of the input.
+///   top ::= definition | external | expression | ';'
+TopLevelItem ParseTopLevelItem(const s::function<s::string()> &ExprName);
+
+/// SkimDefinition - Parse a definition's prototype but only step over its
+/// body, setting Body to where the body is in the lexer input (which must be
+/// a string).  Parse the body later with ParseSkimmedBody.
+s::unique_ptr<PrototypeAST> SkimDefinition(SourceRange &Body);
+
+/// ParseSkimmedBody - Parse the body that SkimDefinition found at Body in
+/// Source.  The lexer and CurTok are restored afterwards, so this may be
+/// called in the middle of parsing something else.
+s::unique_ptr<ExprAST> ParseSkimmedBody(const s::string &Source, const SourceRange &Body);
+
 } // namespace k
 } // namespace llvmpg
 
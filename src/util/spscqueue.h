@@ -0,0 +1,102 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <utility>
+
+namespace llvmpg {
+
+namespace s = std;
+
+//===----------------------------------------------------------------------===//
+// Single Producer Single Consumer Queue
+//===----------------------------------------------------------------------===//
+
+/// SPSCQueue - A bounded queue between one producer and one consumer thread,
+/// without locks: each side owns one index into a ring of slots and
+/// publishes it with a release store.  A full queue makes the producer wait
+/// and an empty one the consumer, so a pipeline of such queues holds at most
+/// their capacity in flight.  Waiting spins briefly, then yields, then
+/// sleeps, so a stalled stage does not burn the CPU the others need.
+template <typename T>
+struct SPSCQueue {
+  // The indices only grow; a slot is an index modulo the capacity.
+  alignas(64) s::atomic<size_t> Head{0}; // next slot to pop, owned by the consumer
+  alignas(64) s::atomic<size_t> Tail{0}; // next slot to push, owned by the producer
+  alignas(64) s::atomic<bool> Closed{false};
+  size_t Mask;
+  s::unique_ptr<T[]> Slots;
+
+  /// SPSCQueue - A queue of Capacity items, rounded up to a power of two.
+  explicit SPSCQueue(size_t Capacity) {
+    size_t Size = 1;
+    while (Size < Capacity)
+      Size *= 2;
+    Mask = Size - 1;
+    Slots.reset(new T[Size]);
+  }
+
+  size_t capacity() const { return Mask + 1; }
+
+  /// tryPush - Append V unless the queue is full.
+  bool tryPush(T &V) {
+    size_t At = Tail.load(s::memory_order_relaxed);
+    if (At - Head.load(s::memory_order_acquire) > Mask)
+      return false;
+    Slots[At & Mask] = s::move(V);
+    Tail.store(At + 1, s::memory_order_release);
+    return true;
+  }
+
+  /// push - Append V, waiting for room.
+  void push(T V) {
+    for (unsigned Spins = 0; not tryPush(V); ++Spins)
+      Backoff(Spins);
+  }
+
+  /// tryPop - Take the oldest item into Out unless the queue is empty.
+  bool tryPop(T &Out) {
+    size_t At = Head.load(s::memory_order_relaxed);
+    if (At == Tail.load(s::memory_order_acquire))
+      return false;
+    Out = s::move(Slots[At & Mask]);
+    Slots[At & Mask] = T();
+    Head.store(At + 1, s::memory_order_release);
+    return true;
+  }
+
+  /// pop - Take the oldest item into Out, waiting for one.  Returns false
+  /// once the queue is closed and empty.
+  bool pop(T &Out) {
+    for (unsigned Spins = 0;; ++Spins) {
+      // Read Closed first: an item pushed before closing is then seen.
+      bool Done = Closed.load(s::memory_order_acquire);
+      if (tryPop(Out))
+        return true;
+      if (Done)
+        return false;
+      Backoff(Spins);
+    }
+  }
+
+  /// close - Tell the consumer no more items follow.  Called by the producer.
+  void close() { Closed.store(true, s::memory_order_release); }
+
+protected:
+  static void Backoff(unsigned Spins) {
+    if (Spins < 64)
+      return;
+    if (Spins < 128)
+      s::this_thread::yield();
+    else
+      s::this_thread::sleep_for(s::chrono::microseconds(50));
+  }
+};
+
+} // namespace llvmpg
+
+#endif
@@ -0,0 +1,97 @@
+#include <util/threadpool.h>
+#include <algorithm>
+
+namespace llvmpg {
+
+namespace s = std;
+
+//===----------------------------------------------------------------------===//
+// Thread Pool
+//===----------------------------------------------------------------------===//
+
+// The pool the current thread works for, and its deque there.
+static thread_local const ThreadPool *CurrentPool = nullptr;
+static thread_local unsigned CurrentWorker = 0;
+
+ThreadPool::ThreadPool(unsigned Threads) {
+  Threads = s::max(Threads, 1u);
+  for (unsigned i = 0; i != Threads; ++i)
+    Queues.push_back(s::make_unique<Queue>());
+  for (unsigned i = 0; i != Threads; ++i)
+    Workers.emplace_back([this, i]() { work(i); });
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    s::lock_guard<s::mutex> Guard(Lock);
+    Stop = true;
+  }
+  Wake.notify_all();
+  for (s::thread &T : Workers)
+    T.join();
+}
+
+void ThreadPool::async(Task T) {
+  unsigned Target = CurrentPool == this ? CurrentWorker : Next++ % Queues.size();
+  ++Pending;
+  {
+    Queue &Q = *Queues[Target];
+    s::lock_guard<s::mutex> Guard(Q.Lock);
+    Q.Tasks.push_back(s::move(T));
+    ++Queued;
+  }
+  // Taking Lock orders this with a worker about to sleep, so it cannot miss
+  // the wake up.
+  { s::lock_guard<s::mutex> Guard(Lock); }
+  Wake.notify_one();
+}
+
+void ThreadPool::wait() {
+  s::unique_lock<s::mutex> Guard(Lock);
+  Idle.wait(Guard, [this]() { return Pending == 0; });
+}
+
+bool ThreadPool::pop(Task &Out, unsigned Self) {
+  unsigned N = Queues.size();
+  for (unsigned i = 0; i != N; ++i) {
+    Queue &Q = *Queues[(Self + i) % N];
+    s::lock_guard<s::mutex> Guard(Q.Lock);
+    if (Q.Tasks.empty())
+      continue;
+    // Own work newest first (its data is likely still in cache), stolen
+    // work oldest first.
+    if (i == 0) {
+      Out = s::move(Q.Tasks.back());
+      Q.Tasks.pop_back();
+    } else {
+      Out = s::move(Q.Tasks.front());
+      Q.Tasks.pop_front();
+    }
+    --Queued;
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::work(unsigned Self) {
+  CurrentPool = this;
+  CurrentWorker = Self;
+  while (true) {
+    Task T;
+    if (pop(T, Self)) {
+      T();
+      if (--Pending == 0) {
+        s::lock_guard<s::mutex> Guard(Lock);
+        Idle.notify_all();
+      }
+      continue;
+    }
+
+    s::unique_lock<s::mutex> Guard(Lock);
+    Wake.wait(Guard, [this]() { return Stop or Queued != 0; });
+    if (Stop and Queued == 0)
+      return;
+  }
+}
+
+} // namespace llvmpg
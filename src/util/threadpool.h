@@ -0,0 +1,63 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace llvmpg {
+
+namespace s = std;
+
+//===----------------------------------------------------------------------===//
+// Thread Pool
+//===----------------------------------------------------------------------===//
+
+/// ThreadPool - A work-stealing pool of worker threads.  Every worker owns a
+/// deque: tasks submitted from a worker go to its own deque, which it drains
+/// newest first, and idle workers steal the oldest task of another deque.
+/// Tasks submitted from outside the pool are spread over the deques.
+struct ThreadPool {
+  using Task = s::function<void()>;
+
+  struct Queue {
+    s::mutex Lock;
+    s::deque<Task> Tasks;
+  };
+
+  s::vector<s::unique_ptr<Queue>> Queues; // one per worker
+  s::vector<s::thread> Workers;
+  s::mutex Lock;                // for sleeping on Wake and Idle
+  s::condition_variable Wake;   // a task was queued, or the pool stops
+  s::condition_variable Idle;   // every task finished
+  s::atomic<size_t> Queued{0};  // tasks in the deques
+  s::atomic<size_t> Pending{0}; // tasks submitted and not finished
+  s::atomic<unsigned> Next{0};  // deque for the next outside submission
+  bool Stop = false;
+
+  explicit ThreadPool(unsigned Threads = s::thread::hardware_concurrency());
+  ~ThreadPool();
+
+  unsigned size() const { return Workers.size(); }
+
+  /// async - Run T on some worker.
+  void async(Task T);
+
+  /// wait - Block until every submitted task has finished.  Must not be
+  /// called from a task.
+  void wait();
+
+protected:
+  void work(unsigned Self);
+  /// pop - Take a task from the deque of Self, or steal one.
+  bool pop(Task &Out, unsigned Self);
+};
+
+} // namespace llvmpg
+
+#endif
@@ -0,0 +1,59 @@
+#include <engine/engine.h>
+#include <codegen/optimize.h>
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace s = std;
+namespace k = llvmpg::k;
+
+namespace {
+
+unsigned Calls = 0;
+
+double Record(double X) {
+  ++Calls;
+  return X;
+}
+
+/// Evaluate - The values of the top-level expressions of Source, compiled at
+/// OptLevel by a fresh engine.
+s::vector<double> Evaluate(const s::string &Source, unsigned OptLevel) {
+  k::EngineOptions O;
+  O.OptLevel = OptLevel;
+  k::Engine E(O);
+  E.registerFunction<double(double)>("record", &Record);
+  s::vector<double> Results;
+  EXPECT_TRUE(E.compile(Results, Source));
+  return Results;
+}
+
+} // namespace
+
+TEST(BuiltinsTest, PureExternNeedsMatchingArity) {
+  EXPECT_TRUE(k::IsPureExtern("sin", 1));
+  EXPECT_FALSE(k::IsPureExtern("sin", 2));
+  EXPECT_TRUE(k::IsPureExtern("pow", 2));
+  EXPECT_FALSE(k::IsPureExtern("pow", 1));
+  EXPECT_FALSE(k::IsPureExtern("nosuch", 1));
+}
+
+TEST(BuiltinsTest, DefinitionShadowsMathFunction) {
+  for (unsigned OptLevel : {0u, 2u, 3u})
+    EXPECT_EQ(Evaluate("def sin(x) x+1; sin(1);", OptLevel), s::vector<double>{2})
+        << "at -O" << OptLevel;
+}
+
+TEST(BuiltinsTest, DefinitionShadowsLibraryCall) {
+  for (unsigned OptLevel : {0u, 2u, 3u})
+    EXPECT_EQ(Evaluate("def exp(x) x*2; exp(3);", OptLevel), s::vector<double>{6})
+        << "at -O" << OptLevel;
+}
+
+TEST(BuiltinsTest, ImpureDefinitionShadowsMathFunction) {
+  for (unsigned OptLevel : {0u, 2u, 3u}) {
+    Calls = 0;
+    EXPECT_EQ(Evaluate("def sin(x) record(x); sin(65);", OptLevel), s::vector<double>{65})
+        << "at -O" << OptLevel;
+    EXPECT_EQ(Calls, 1u) << "at -O" << OptLevel;
+  }
+}
@@ -0,0 +1,130 @@
+#include <engine/codearena.h>
+#include <gtest/gtest.h>
+#include <llvm/Support/Process.h>
+
+namespace s = std;
+using llvmpg::k::ArenaMemoryManager;
+using llvmpg::k::CodeArena;
+
+namespace {
+
+struct CodeArenaTest : public ::testing::Test {
+  size_t Page = llvm::sys::Process::getPageSizeEstimate();
+  s::unique_ptr<CodeArena> Arena;
+
+  /// SetUp - An arena of four slabs of one page each.
+  void SetUp() override {
+    auto A = CodeArena::Create(4 * Page, Page, false);
+    ASSERT_TRUE(bool(A)) << llvm::toString(A.takeError());
+    Arena = s::move(*A);
+  }
+};
+
+} // namespace
+
+TEST(CodeArenaCreateTest, RejectsBadSizes) {
+  size_t Page = llvm::sys::Process::getPageSizeEstimate();
+  auto Unaligned = CodeArena::Create(4 * Page, Page + 1, false);
+  EXPECT_FALSE(bool(Unaligned));
+  llvm::consumeError(Unaligned.takeError());
+  auto Empty = CodeArena::Create(0, Page, false);
+  EXPECT_FALSE(bool(Empty));
+  llvm::consumeError(Empty.takeError());
+}
+
+TEST_F(CodeArenaTest, ViewsShareMemory) {
+  size_t At = Arena->allocate("", 16, 16);
+  ASSERT_NE(At, Arena->Capacity);
+  Arena->RW[At] = 0xc3;
+  EXPECT_EQ(Arena->RX[At], 0xc3);
+}
+
+TEST_F(CodeArenaTest, PacksObjectsByGroup) {
+  size_t A1 = Arena->allocate("a", 100, 16);
+  size_t B1 = Arena->allocate("b", 100, 16);
+  size_t A2 = Arena->allocate("a", 100, 64);
+  EXPECT_EQ(A1, 0u);
+  EXPECT_EQ(B1, Page);
+  EXPECT_EQ(A2, 128u);
+
+  auto Stats = Arena->stats();
+  EXPECT_EQ(Stats.Reserved, 4 * Page);
+  EXPECT_EQ(Stats.Committed, 2 * Page);
+  EXPECT_EQ(Stats.Used, 300u);
+  EXPECT_EQ(Stats.Objects, 3u);
+  EXPECT_EQ(Stats.Slabs, 2u);
+}
+
+TEST_F(CodeArenaTest, ReleaseKeepsSlabOfItsGroup) {
+  size_t A1 = Arena->allocate("a", 100, 16);
+  Arena->release(A1, 100);
+  auto Stats = Arena->stats();
+  EXPECT_EQ(Stats.Slabs, 1u);
+  EXPECT_EQ(Stats.FreeSlabs, 0u);
+  EXPECT_EQ(Stats.Used, 0u);
+  // The group starts over at the beginning of its slab.
+  EXPECT_EQ(Arena->allocate("a", 100, 16), A1);
+}
+
+TEST_F(CodeArenaTest, ReusesFreedSlab) {
+  size_t A1 = Arena->allocate("a", Page / 2, 16);
+  // Does not fit behind A1: the group moves on to a new slab.
+  size_t A2 = Arena->allocate("a", Page / 2 + 16, 16);
+  EXPECT_EQ(A2, Page);
+
+  // The retired slab is freed once its object goes.
+  Arena->release(A1, Page / 2);
+  auto Stats = Arena->stats();
+  EXPECT_EQ(Stats.Slabs, 1u);
+  EXPECT_EQ(Stats.FreeSlabs, 1u);
+
+  // And is the next slab handed out.
+  EXPECT_EQ(Arena->allocate("b", 100, 16), A1);
+  EXPECT_EQ(Arena->stats().FreeSlabs, 0u);
+}
+
+TEST_F(CodeArenaTest, LargeObjectTakesRunOfSlabs) {
+  size_t Big = Arena->allocate("a", 2 * Page + 1, 16);
+  EXPECT_EQ(Big, 0u);
+  // The run is not filled by the group.
+  EXPECT_EQ(Arena->allocate("a", 16, 16), 3 * Page);
+  Arena->release(Big, 2 * Page + 1);
+  EXPECT_EQ(Arena->stats().FreeSlabs, 3u);
+}
+
+TEST_F(CodeArenaTest, FullArena) {
+  for (unsigned i = 0; i != 4; ++i)
+    ASSERT_EQ(Arena->allocate("", Page, 16), i * Page);
+  EXPECT_EQ(Arena->allocate("", 16, 16), Arena->Capacity);
+  EXPECT_EQ(Arena->stats().Objects, 4u);
+}
+
+TEST_F(CodeArenaTest, MemoryManagerFallsBackWhenFull) {
+  for (unsigned i = 0; i != 4; ++i)
+    ASSERT_EQ(Arena->allocate("", Page, 16), i * Page);
+
+  ArenaMemoryManager MM(*Arena, "");
+  MM.reserveAllocationSpace(64, 16, 0, 1, 0, 1);
+  EXPECT_TRUE(MM.Fallback);
+  uint8_t *Code = MM.allocateCodeSection(64, 16, 0, ".text");
+  ASSERT_NE(Code, nullptr);
+  EXPECT_TRUE(Code < Arena->RX or Code >= Arena->RW + Arena->Capacity);
+  EXPECT_EQ(Arena->stats().Objects, 4u);
+}
+
+TEST_F(CodeArenaTest, MemoryManagerReleasesSpan) {
+  {
+    ArenaMemoryManager MM(*Arena, "a");
+    MM.reserveAllocationSpace(64, 16, 32, 16, 16, 16);
+    EXPECT_FALSE(MM.Fallback);
+    uint8_t *Code = MM.allocateCodeSection(64, 16, 0, ".text");
+    uint8_t *RO = MM.allocateDataSection(32, 16, 1, ".rodata", true);
+    uint8_t *RW = MM.allocateDataSection(16, 16, 2, ".data", false);
+    EXPECT_EQ(Code, Arena->RW);
+    EXPECT_EQ(RO, Code + 64);
+    EXPECT_EQ(RW, RO + 32);
+    EXPECT_EQ(Arena->stats().Used, 112u);
+  }
+  EXPECT_EQ(Arena->stats().Used, 0u);
+  EXPECT_EQ(Arena->stats().Objects, 0u);
+}
@@ -0,0 +1,125 @@
+#include <engine/engine.h>
+#include <engine/jit.h>
+#include <parser/parser.h>
+#include <gtest/gtest.h>
+#include <llvm/Support/Error.h>
+#include <string>
+#include <vector>
+
+namespace s = std;
+namespace k = llvmpg::k;
+
+namespace {
+
+double Record(double X) { return X; }
+
+/// HotReloadTest - Recompiling edited sources, in sequence or with the
+/// pipeline (the parameter).
+struct HotReloadTest : public ::testing::TestWithParam<bool> {
+  /// Make - An engine with inlining across definitions off, so that only the
+  /// interface of a callee decides whether its callers are lowered again.
+  static s::unique_ptr<k::Engine> Make() {
+    k::EngineOptions O;
+    O.InlineSize = 0;
+    O.Pipeline = GetParam();
+    auto E = s::make_unique<k::Engine>(O);
+    E->registerFunction<double(double)>("hrRecord", &Record);
+    return E;
+  }
+
+  /// Defined - Whether the JIT has a symbol Name.
+  static bool Defined(k::Engine &E, const s::string &Name) {
+    auto Sym = E.JIT->lookup(Name);
+    if (Sym)
+      return true;
+    llvm::consumeError(Sym.takeError());
+    return false;
+  }
+};
+
+} // namespace
+
+TEST_P(HotReloadTest, UnchangedDefinitionIsSkipped) {
+  auto E = Make();
+  ASSERT_TRUE(E->compile("def hrSame(x) x+1;"));
+  EXPECT_EQ(E->Definitions["hrSame"].Version, 1u);
+  // Only the layout, a comment and the parameter name differ.
+  ASSERT_TRUE(E->compile("# again\ndef hrSame(y)\n  y + 1;"));
+  EXPECT_EQ(E->Definitions["hrSame"].Version, 1u);
+  EXPECT_FALSE(Defined(*E, "hrSame.v2"));
+}
+
+TEST_P(HotReloadTest, EditedDefinitionGetsNewVersion) {
+  auto E = Make();
+  s::vector<double> Results;
+  ASSERT_TRUE(E->compile(Results, "def hrEdit(x) x+1; def hrEditCaller(x) hrEdit(x)*2; "
+                                  "hrEditCaller(1);"));
+  ASSERT_TRUE(E->compile(Results, "def hrEdit(x) x+3; hrEditCaller(1);"));
+  EXPECT_EQ(Results, (s::vector<double>{4, 8}));
+  EXPECT_EQ(E->Definitions["hrEdit"].Version, 2u);
+  EXPECT_TRUE(Defined(*E, "hrEdit.v1"));
+  EXPECT_TRUE(Defined(*E, "hrEdit.v2"));
+  auto *Edit = E->lookup<double(double)>("hrEdit");
+  ASSERT_TRUE(Edit);
+  EXPECT_EQ(Edit(1), 4);
+  // Still pure and terminating: the caller reaches the new version through
+  // the stub, without being lowered again.
+  EXPECT_EQ(E->Definitions["hrEditCaller"].Version, 1u);
+}
+
+TEST_P(HotReloadTest, InterfaceChangeLowersCallers) {
+  auto E = Make();
+  s::vector<double> Results;
+  ASSERT_TRUE(E->compile(Results, "def hrPure(x) x+1; def hrPureCaller(x) hrPure(x)*2; "
+                                  "def hrUnrelated(x) x; hrPureCaller(1);"));
+  // Calling host code makes the definition impure, which callers may have
+  // relied on.
+  ASSERT_TRUE(E->compile(Results, "def hrPure(x) hrRecord(x)+2; hrPureCaller(1);"));
+  EXPECT_EQ(Results, (s::vector<double>{4, 6}));
+  EXPECT_EQ(E->Definitions["hrPure"].Version, 2u);
+  EXPECT_EQ(E->Definitions["hrPureCaller"].Version, 2u);
+  EXPECT_EQ(E->Definitions["hrUnrelated"].Version, 1u);
+}
+
+TEST_P(HotReloadTest, FailedDefinitionKeepsPreviousVersion) {
+  auto E = Make();
+  s::vector<double> Results;
+  ASSERT_TRUE(E->compile(Results, "def hrKeep(x) x+1; def hrKeepCaller(x) hrKeep(x)*2;"));
+  uint64_t Hash = E->Definitions["hrKeep"].Hash;
+
+  // Fails to generate.
+  EXPECT_FALSE(E->compile(Results, "def hrKeep(x) hrNoSuch(x); hrKeepCaller(1);"));
+  EXPECT_EQ(E->Definitions["hrKeep"].Version, 1u);
+  EXPECT_EQ(E->Definitions["hrKeep"].Hash, Hash);
+
+  // Fails to link.
+  EXPECT_FALSE(E->compile(Results, "extern hrMissing(x); def hrKeep(x) hrMissing(x); "
+                                   "hrKeepCaller(2);"));
+  EXPECT_EQ(E->Definitions["hrKeep"].Hash, Hash);
+  EXPECT_EQ(Results, (s::vector<double>{4, 6}));
+
+  // Neither is taken for unchanged: both are tried again.
+  EXPECT_FALSE(E->compile("def hrKeep(x) hrMissing(x);"));
+  EXPECT_FALSE(E->compile("def hrKeep(x) hrNoSuch(x);"));
+  auto *Keep = E->lookup<double(double)>("hrKeep");
+  ASSERT_TRUE(Keep);
+  EXPECT_EQ(Keep(1), 2);
+
+  ASSERT_TRUE(E->compile(Results, "def hrKeep(x) x+5; hrKeepCaller(1);"));
+  EXPECT_EQ(Results.back(), 12);
+}
+
+TEST_P(HotReloadTest, FailedNewDefinitionIsDropped) {
+  auto E = Make();
+  EXPECT_FALSE(E->compile("extern hrMissing(x); def hrDropped(x) hrMissing(x); 1;"));
+  EXPECT_FALSE(E->Definitions.count("hrDropped"));
+  ASSERT_TRUE(E->compile("def hrDropped(x) x*3;"));
+  auto *Dropped = E->lookup<double(double)>("hrDropped");
+  ASSERT_TRUE(Dropped);
+  EXPECT_EQ(Dropped(2), 6);
+}
+
+INSTANTIATE_TEST_SUITE_P(Engine, HotReloadTest, ::testing::Bool(),
+                         [](const ::testing::TestParamInfo<bool> &Info) {
+                           return Info.param ? "Pipeline" : "Sequential";
+                         });
@@ -0,0 +1,106 @@
+#include <codegen/codegen.h>
+#include <gtest/gtest.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instruction.h>
+#include <string>
+
+namespace s = std;
+namespace k = llvmpg::k;
+
+namespace {
+
+struct HashConsTest : public ::testing::Test {
+  k::ASTFactory SavedFactory = k::Factory;
+
+  void SetUp() override {
+    if (k::BinopPrecedence.empty())
+      k::BinopPrecedence = {{'<', 10}, {'+', 20}, {'-', 20}, {'*', 40}};
+    k::InitializeModule();
+  }
+  void TearDown() override { k::Factory = SavedFactory; }
+
+  /// Parse - The def in Source, with identical subexpressions shared if
+  /// HashCons.
+  s::unique_ptr<k::FunctionAST> Parse(const s::string &Source, bool HashCons) {
+    k::Factory = HashCons ? k::MakeHashConsFactory(k::CodegenFactory) : k::CodegenFactory;
+    k::SetLexerInput(Source);
+    k::getNextToken();
+    auto F = k::ParseDefinition();
+    EXPECT_TRUE(F);
+    return F;
+  }
+
+  /// Target - The subtree the shared reference E refers to.
+  static k::SharedNode *Target(const k::ExprAST &E) {
+    EXPECT_EQ(E.Kind, k::EK_Shared);
+    return static_cast<const k::SharedExprAST &>(E).Target;
+  }
+
+  /// Count - The number of instructions with Opcode in F.
+  static unsigned Count(llvm::Function &F, unsigned Opcode) {
+    unsigned N = 0;
+    for (llvm::Instruction &I : llvm::instructions(F))
+      N += I.getOpcode() == Opcode;
+    return N;
+  }
+};
+
+} // namespace
+
+TEST_F(HashConsTest, IdenticalSubexpressionsAreShared) {
+  auto F = Parse("def hcSquare(x) (x*x+1)*(x*x+1)", true);
+  // x, 1, x*x, x*x+1 and the product, each built once.
+  EXPECT_EQ(F->Shared.size(), 5u);
+  auto &Product = static_cast<k::BinaryExprAST &>(*Target(*F->Body)->Node);
+  k::SharedNode *Sum = Target(*Product.LHS);
+  EXPECT_EQ(Target(*Product.RHS), Sum);
+  EXPECT_EQ(Sum->Uses, 2u);
+  auto &SumNode = static_cast<k::BinaryExprAST &>(*Sum->Node);
+  EXPECT_EQ(SumNode.Op, '+');
+  EXPECT_EQ(Target(*SumNode.LHS)->Uses, 2u);
+}
+
+TEST_F(HashConsTest, TableIsScopedToOneFunction) {
+  auto F = Parse("def hcFirst(x) x*x+1", true);
+  EXPECT_EQ(k::HashConsTableSize(), 0u);
+  auto G = Parse("def hcSecond(x) x*x+1", true);
+  for (auto &N : G->Shared)
+    for (auto &M : F->Shared)
+      EXPECT_NE(N.get(), M.get());
+  // Every reference in G is to a subtree G owns.
+  k::SharedNode *Sum = Target(*G->Body);
+  bool Owned = false;
+  for (auto &N : G->Shared)
+    Owned = Owned or N.get() == Sum;
+  EXPECT_TRUE(Owned);
+}
+
+TEST_F(HashConsTest, SharingKeepsHashAndMeaning) {
+  auto Plain = Parse("def hcSame(x) (x*x+1)*(x*x+1)", false);
+  auto Shared = Parse("def hcSame(y)  (y*y + 1) * (y*y + 1)", true);
+  EXPECT_EQ(k::HashFunction(*Plain), k::HashFunction(*Shared));
+  EXPECT_TRUE(k::SameFunction(*Plain, *Shared));
+
+  auto Other = Parse("def hcSame(x) (x*x+1)*(x*x+2)", true);
+  EXPECT_NE(k::HashFunction(*Plain), k::HashFunction(*Other));
+  EXPECT_FALSE(k::SameFunction(*Plain, *Other));
+  auto Swapped = Parse("def hcSame(x y) x-y", false);
+  auto Renamed = Parse("def hcSame(y x) y-x", false);
+  auto Reversed = Parse("def hcSame(x y) y-x", false);
+  EXPECT_TRUE(k::SameFunction(*Swapped, *Renamed));
+  EXPECT_FALSE(k::SameFunction(*Swapped, *Reversed));
+}
+
+TEST_F(HashConsTest, SharedSubexpressionIsEmittedOnce) {
+  auto Plain = Parse("def hcEmitPlain(x) (x*x+1)*(x*x+1)", false);
+  llvm::Function *PlainF = Plain->codegen();
+  ASSERT_TRUE(PlainF);
+  EXPECT_EQ(Count(*PlainF, llvm::Instruction::FMul), 3u);
+  EXPECT_EQ(Count(*PlainF, llvm::Instruction::FAdd), 2u);
+
+  auto Shared = Parse("def hcEmitShared(x) (x*x+1)*(x*x+1)", true);
+  llvm::Function *SharedF = Shared->codegen();
+  ASSERT_TRUE(SharedF);
+  EXPECT_EQ(Count(*SharedF, llvm::Instruction::FMul), 2u);
+  EXPECT_EQ(Count(*SharedF, llvm::Instruction::FAdd), 1u);
+}
@@ -0,0 +1,81 @@
+#include <codegen/codegen.h>
+#include <gtest/gtest.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+#include <string>
+
+namespace s = std;
+namespace k = llvmpg::k;
+
+namespace {
+
+const unsigned DeepNesting = 100000;
+
+struct ParserTest : public ::testing::Test {
+  unsigned SavedMaxNestingDepth = k::MaxNestingDepth;
+  k::ASTFactory SavedFactory = k::Factory;
+
+  void SetUp() override {
+    if (k::BinopPrecedence.empty())
+      k::BinopPrecedence = {{'<', 10}, {'+', 20}, {'-', 20}, {'*', 40}};
+    k::Factory = k::CodegenFactory;
+    k::InitializeModule();
+  }
+  void TearDown() override {
+    k::MaxNestingDepth = SavedMaxNestingDepth;
+    k::Factory = SavedFactory;
+  }
+
+  s::unique_ptr<k::FunctionAST> Parse(const s::string &Source) {
+    k::SetLexerInput(Source);
+    k::getNextToken();
+    return k::ParseDefinition();
+  }
+
+  /// Repeat - S repeated N times.
+  static s::string Repeat(const s::string &S, unsigned N) {
+    s::string R;
+    R.reserve(S.size() * N);
+    for (unsigned i = 0; i != N; ++i)
+      R += S;
+    return R;
+  }
+
+  /// Generate - Parse, emit and verify the def in Source, and free its AST.
+  void Generate(const s::string &Source) {
+    auto F = Parse(Source);
+    ASSERT_TRUE(F);
+    llvm::Function *Fn = F->codegen();
+    ASSERT_TRUE(Fn);
+    EXPECT_FALSE(llvm::verifyFunction(*Fn, &llvm::errs()));
+    F.reset();
+  }
+};
+
+} // namespace
+
+TEST_F(ParserTest, DeepParentheses) {
+  // 1+(1+(1+(...(x)...))) is nested as deep on the right.
+  Generate("def deepParens(x) " + Repeat("1+(", DeepNesting) + "x" + Repeat(")", DeepNesting));
+}
+
+TEST_F(ParserTest, DeepOperatorChain) {
+  // x+1+1+...+1 is nested as deep on the left.
+  Generate("def deepChain(x) x" + Repeat("+1", DeepNesting));
+}
+
+TEST_F(ParserTest, DeepCalls) {
+  Generate("def deepId(x) x;");
+  Generate("def deepCalls(x) " + Repeat("deepId(", DeepNesting) + "x" +
+           Repeat(")", DeepNesting));
+}
+
+TEST_F(ParserTest, NestingDepthCap) {
+  k::MaxNestingDepth = 100;
+  EXPECT_TRUE(Parse("def capped(x) " + Repeat("(", 100) + "x" + Repeat(")", 100)));
+  EXPECT_FALSE(Parse("def capped(x) " + Repeat("(", 101) + "x" + Repeat(")", 101)));
+  EXPECT_FALSE(Parse("def capped(x) " + Repeat("capped(", 101) + "x" + Repeat(")", 101)));
+  // A far deeper input is refused just as well.
+  EXPECT_FALSE(
+      Parse("def capped(x) " + Repeat("(", DeepNesting) + "x" + Repeat(")", DeepNesting)));
+}
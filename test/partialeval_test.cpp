@@ -0,0 +1,132 @@
+#include <codegen/codegen.h>
+#include <gtest/gtest.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+#include <string>
+#include <vector>
+
+namespace s = std;
+namespace k = llvmpg::k;
+
+namespace {
+
+struct PartialEvalTest : public ::testing::Test {
+  k::CodegenOptions Saved = k::Options;
+  k::ASTFactory SavedFactory = k::Factory;
+
+  void SetUp() override {
+    if (k::BinopPrecedence.empty())
+      k::BinopPrecedence = {{'<', 10}, {'+', 20}, {'-', 20}, {'*', 40}};
+    k::Options.PartialEval = true;
+    k::Factory = k::CodegenFactory;
+    k::InitializeModule();
+  }
+  void TearDown() override {
+    k::Options = Saved;
+    k::Factory = SavedFactory;
+  }
+
+  /// Generate - Emit the defs in Source into the current module.
+  void Generate(const s::string &Source) {
+    k::SetLexerInput(Source);
+    k::getNextToken();
+    while (k::CurTok == k::tok_def) {
+      auto F = k::ParseDefinition();
+      ASSERT_TRUE(F);
+      ASSERT_TRUE(F->codegen());
+      if (k::CurTok == ';')
+        k::getNextToken();
+    }
+  }
+
+  /// Callees - The names of the functions F calls, in order.
+  s::vector<s::string> Callees(const s::string &F) {
+    s::vector<s::string> Names;
+    for (llvm::Instruction &I : llvm::instructions(*k::TheModule->getFunction(F)))
+      if (auto *Call = llvm::dyn_cast<llvm::CallInst>(&I))
+        Names.push_back(Call->getCalledFunction()->getName().str());
+    return Names;
+  }
+
+  /// Clones - The number of partial clones of F in the current module.
+  unsigned Clones(const s::string &F) {
+    unsigned N = 0;
+    for (llvm::Function &G : *k::TheModule)
+      N += G.getName().startswith(F + ".pe");
+    return N;
+  }
+
+  bool Verify() { return not llvm::verifyModule(*k::TheModule, &llvm::errs()); }
+};
+
+} // namespace
+
+TEST_F(PartialEvalTest, ConstantArgumentsFold) {
+  Generate("def peMulAdd(x y) x*y + 1; def peFolded(z) peMulAdd(3, 4) + z;");
+  // The call is gone: its value is a literal.
+  EXPECT_TRUE(Callees("peFolded").empty());
+  EXPECT_EQ(Clones("peMulAdd"), 0u);
+  auto *Add = llvm::cast<llvm::BinaryOperator>(&*llvm::inst_begin(
+      *k::TheModule->getFunction("peFolded")));
+  auto *C = llvm::dyn_cast<llvm::ConstantFP>(Add->getOperand(0));
+  ASSERT_TRUE(C);
+  EXPECT_EQ(C->getValueAPF().convertToDouble(), 13);
+  EXPECT_TRUE(Verify());
+}
+
+TEST_F(PartialEvalTest, SomeConstantArgumentsCallClone) {
+  Generate("def peScale(x y) x*y; def pePartial(z) peScale(2, z) + peScale(2, z+1);");
+  // Both calls share the clone taking the remaining argument.
+  EXPECT_EQ(Clones("peScale"), 1u);
+  EXPECT_EQ(Callees("pePartial"), (s::vector<s::string>{"peScale.pe0", "peScale.pe0"}));
+  EXPECT_EQ(k::TheModule->getFunction("peScale.pe0")->arg_size(), 1u);
+  EXPECT_TRUE(Verify());
+}
+
+TEST_F(PartialEvalTest, NoConstantArgumentsCallDefinition) {
+  Generate("def peId(x) x; def peDirect(z) peId(z);");
+  EXPECT_EQ(Callees("peDirect"), s::vector<s::string>{"peId"});
+  EXPECT_EQ(Clones("peId"), 0u);
+}
+
+TEST_F(PartialEvalTest, SelfRecursiveCloneCallsItself) {
+  // The recursive call has the same constant, so it goes to the clone
+  // being emitted.
+  Generate("def peLoop(n x) peLoop(n, x+1); def peLoopUse(z) peLoop(3, z);");
+  EXPECT_EQ(Clones("peLoop"), 1u);
+  EXPECT_EQ(Callees("peLoopUse"), s::vector<s::string>{"peLoop.pe0"});
+  EXPECT_EQ(Callees("peLoop.pe0"), s::vector<s::string>{"peLoop.pe0"});
+  EXPECT_TRUE(Verify());
+}
+
+TEST_F(PartialEvalTest, DepthLimitStopsRecursiveSpecialization) {
+  // Every level has a new constant: specialization stops at the depth
+  // limit, and the innermost clone calls the definition.
+  Generate("def peCount(n) peCount(n+1); def peCountUse(z) peCount(0) + z;");
+  unsigned N = Clones("peCount");
+  EXPECT_GT(N, 1u);
+  EXPECT_LE(N, 16u);
+  EXPECT_EQ(Callees("peCount.pe" + s::to_string(N - 1)), s::vector<s::string>{"peCount"});
+  EXPECT_TRUE(Verify());
+}
+
+TEST_F(PartialEvalTest, BudgetLimitsSpecialization) {
+  // The body of peSum has 5 nodes: the budget allows one clone.
+  k::Options.SpecializeBudget = 7;
+  k::InitializeModule();
+  Generate("def peSum(x y) x+y+x; def peBudget(z) peSum(1, z) + peSum(2, z);");
+  EXPECT_EQ(Clones("peSum"), 1u);
+  EXPECT_EQ(Callees("peBudget"), (s::vector<s::string>{"peSum.pe0", "peSum"}));
+  EXPECT_TRUE(Verify());
+}
+
+TEST_F(PartialEvalTest, BudgetBelowBodySizeSpecializesNothing) {
+  k::Options.SpecializeBudget = 4;
+  k::InitializeModule();
+  Generate("def peSum2(x y) x+y+x; def peNoBudget(z) peSum2(1, 2) + z;");
+  EXPECT_EQ(Clones("peSum2"), 0u);
+  EXPECT_EQ(Callees("peNoBudget"), s::vector<s::string>{"peSum2"});
+}
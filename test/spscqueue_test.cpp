@@ -0,0 +1,111 @@
+#include <util/spscqueue.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace s = std;
+using llvmpg::SPSCQueue;
+
+TEST(SPSCQueueTest, RoundsCapacityUpToPowerOfTwo) {
+  EXPECT_EQ(SPSCQueue<int>(1).capacity(), 1u);
+  EXPECT_EQ(SPSCQueue<int>(3).capacity(), 4u);
+  EXPECT_EQ(SPSCQueue<int>(64).capacity(), 64u);
+}
+
+TEST(SPSCQueueTest, WrapsAround) {
+  // Enough rounds for the indices to pass the ring many times over, at
+  // every fill level.
+  SPSCQueue<int> Q(4);
+  int Next = 0, Expected = 0;
+  for (unsigned Round = 0; Round != 100; ++Round) {
+    unsigned Fill = Round % 4 + 1;
+    for (unsigned i = 0; i != Fill; ++i) {
+      int V = Next++;
+      ASSERT_TRUE(Q.tryPush(V));
+    }
+    int Out;
+    for (unsigned i = 0; i != Fill; ++i) {
+      ASSERT_TRUE(Q.tryPop(Out));
+      EXPECT_EQ(Out, Expected++);
+    }
+    EXPECT_FALSE(Q.tryPop(Out));
+  }
+}
+
+TEST(SPSCQueueTest, FullQueueRefusesPush) {
+  SPSCQueue<int> Q(2);
+  int A = 1, B = 2, C = 3, Out;
+  EXPECT_TRUE(Q.tryPush(A));
+  EXPECT_TRUE(Q.tryPush(B));
+  EXPECT_FALSE(Q.tryPush(C));
+  EXPECT_EQ(C, 3); // not moved from
+  ASSERT_TRUE(Q.tryPop(Out));
+  EXPECT_EQ(Out, 1);
+  EXPECT_TRUE(Q.tryPush(C));
+}
+
+TEST(SPSCQueueTest, PushWaitsForConsumer) {
+  SPSCQueue<int> Q(2);
+  Q.push(0);
+  Q.push(1);
+  s::atomic<bool> Pushed{false};
+  s::thread Producer([&]() {
+    Q.push(2);
+    Pushed = true;
+  });
+  // The producer cannot get ahead of the consumer by more than the capacity.
+  s::this_thread::sleep_for(s::chrono::milliseconds(20));
+  EXPECT_FALSE(Pushed);
+  int Out;
+  ASSERT_TRUE(Q.pop(Out));
+  EXPECT_EQ(Out, 0);
+  Producer.join();
+  EXPECT_TRUE(Pushed);
+  ASSERT_TRUE(Q.pop(Out));
+  EXPECT_EQ(Out, 1);
+  ASSERT_TRUE(Q.pop(Out));
+  EXPECT_EQ(Out, 2);
+}
+
+TEST(SPSCQueueTest, CloseDrainsRemainingItems) {
+  SPSCQueue<s::unique_ptr<int>> Q(4);
+  Q.push(s::make_unique<int>(1));
+  Q.push(s::make_unique<int>(2));
+  Q.close();
+  s::unique_ptr<int> Out;
+  ASSERT_TRUE(Q.pop(Out));
+  EXPECT_EQ(*Out, 1);
+  ASSERT_TRUE(Q.pop(Out));
+  EXPECT_EQ(*Out, 2);
+  EXPECT_FALSE(Q.pop(Out));
+  EXPECT_FALSE(Q.pop(Out));
+}
+
+TEST(SPSCQueueTest, CloseWakesWaitingConsumer) {
+  SPSCQueue<int> Q(4);
+  bool Popped = true;
+  s::thread Consumer([&]() {
+    int Out;
+    Popped = Q.pop(Out);
+  });
+  s::this_thread::sleep_for(s::chrono::milliseconds(5));
+  Q.close();
+  Consumer.join();
+  EXPECT_FALSE(Popped);
+}
+
+TEST(SPSCQueueTest, KeepsOrderAcrossThreads) {
+  const int N = 100000;
+  SPSCQueue<int> Q(8);
+  s::thread Producer([&]() {
+    for (int i = 0; i != N; ++i)
+      Q.push(i);
+    Q.close();
+  });
+  int Out, Expected = 0;
+  while (Q.pop(Out))
+    ASSERT_EQ(Out, Expected++);
+  Producer.join();
+  EXPECT_EQ(Expected, N);
+}
@@ -0,0 +1,75 @@
+#include <util/threadpool.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace s = std;
+using llvmpg::ThreadPool;
+
+TEST(ThreadPoolTest, WaitRunsEveryTask) {
+  ThreadPool Pool(4);
+  s::atomic<unsigned> Count{0};
+  for (unsigned i = 0; i != 1000; ++i)
+    Pool.async([&Count]() { ++Count; });
+  Pool.wait();
+  EXPECT_EQ(Count, 1000u);
+
+  // The pool can be waited on again.
+  Pool.async([&Count]() { ++Count; });
+  Pool.wait();
+  EXPECT_EQ(Count, 1001u);
+}
+
+TEST(ThreadPoolTest, WaitCoversTasksSubmittedByTasks) {
+  ThreadPool Pool(2);
+  s::atomic<unsigned> Count{0};
+  for (unsigned i = 0; i != 10; ++i)
+    Pool.async([&Pool, &Count]() {
+      for (unsigned j = 0; j != 10; ++j)
+        Pool.async([&Count]() { ++Count; });
+    });
+  Pool.wait();
+  EXPECT_EQ(Count, 100u);
+}
+
+TEST(ThreadPoolTest, WaitWithoutTasks) {
+  ThreadPool Pool(1);
+  Pool.wait();
+  EXPECT_EQ(Pool.size(), 1u);
+}
+
+TEST(ThreadPoolTest, IdleWorkerStealsQueuedTask) {
+  // Both halves go to the deque of the worker running the outer task, and
+  // each waits for the other: they only finish if another worker steals one.
+  ThreadPool Pool(2);
+  s::atomic<unsigned> Started{0};
+  s::atomic<bool> TimedOut{false};
+  s::mutex Lock;
+  s::set<s::thread::id> Ran;
+  auto Half = [&]() {
+    {
+      s::lock_guard<s::mutex> Guard(Lock);
+      Ran.insert(s::this_thread::get_id());
+    }
+    ++Started;
+    auto Deadline = s::chrono::steady_clock::now() + s::chrono::seconds(10);
+    while (Started < 2) {
+      if (s::chrono::steady_clock::now() > Deadline) {
+        TimedOut = true;
+        return;
+      }
+      s::this_thread::yield();
+    }
+  };
+  Pool.async([&Pool, &Half]() {
+    Pool.async(Half);
+    Pool.async(Half);
+  });
+  Pool.wait();
+  EXPECT_FALSE(TimedOut);
+  EXPECT_EQ(Started, 2u);
+  EXPECT_EQ(Ran.size(), 2u);
+}
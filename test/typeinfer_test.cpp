@@ -0,0 +1,108 @@
+#include <engine/engine.h>
+#include <codegen/codegen.h>
+#include <codegen/typeinfer.h>
+#include <gtest/gtest.h>
+#include <cmath>
+#include <vector>
+
+namespace s = std;
+namespace k = llvmpg::k;
+
+namespace {
+
+struct TypeInferTest : public ::testing::Test {
+  k::CodegenOptions Saved = k::Options;
+
+  void SetUp() override {
+    if (k::BinopPrecedence.empty())
+      k::BinopPrecedence = {{'<', 10}, {'+', 20}, {'-', 20}, {'*', 40}};
+  }
+  void TearDown() override { k::Options = Saved; }
+
+  /// Infer - The signature inferred for the def in Source.
+  k::TypeSignature Infer(const s::string &Source) {
+    k::SetLexerInput(Source);
+    k::getNextToken();
+    auto F = k::ParseDefinition();
+    EXPECT_TRUE(F);
+    return F ? k::InferSignature(*F, false) : k::TypeSignature();
+  }
+
+  /// Apply - The values of Fn applied to Args, compiled from Source with or
+  /// without type inference.
+  s::vector<double> Apply(const s::string &Source, const s::string &Fn,
+                          const s::vector<double> &Args, bool InferTypes) {
+    k::Options.InferTypes = InferTypes;
+    k::Engine E;
+    EXPECT_TRUE(E.compile(Source));
+    auto *F = E.lookup<double(double)>(Fn);
+    EXPECT_TRUE(F);
+    s::vector<double> Results;
+    for (double A : Args)
+      Results.push_back(F ? F(A) : 0);
+    return Results;
+  }
+};
+
+} // namespace
+
+TEST(TypeInferKindTest, IntegerArithmeticStaysBelowExactRange) {
+  EXPECT_EQ(k::BinaryKind('+', k::NK_Int, k::NK_Int, k::MaxExactInt - 1), k::NK_Int);
+  // A bound of 2^53 may be a rounded larger one.
+  EXPECT_EQ(k::BinaryKind('+', k::NK_Int, k::NK_Int, k::MaxExactInt), k::NK_Double);
+  EXPECT_EQ(k::BinaryKind('*', k::NK_Int, k::NK_Int, 1e300), k::NK_Double);
+  EXPECT_EQ(k::BinaryKind('<', k::NK_Double, k::NK_Double, 0), k::NK_Int);
+  EXPECT_EQ(k::BinaryKind('+', k::NK_Int, k::NK_Float, 2), k::NK_Float);
+}
+
+TEST(TypeInferKindTest, LiteralKinds) {
+  EXPECT_EQ(k::LiteralKind(3, false), k::NK_Int);
+  EXPECT_EQ(k::LiteralKind(k::MaxExactInt, false), k::NK_Int);
+  EXPECT_EQ(k::LiteralKind(2 * k::MaxExactInt, false), k::NK_Double);
+  EXPECT_EQ(k::LiteralKind(0.5, false), k::NK_Double);
+  EXPECT_EQ(k::LiteralKind(0.5, true), k::NK_Float);
+}
+
+TEST_F(TypeInferTest, BoundSearchFindsLargestExactParameterRange) {
+  // x*3+1 stays below 2^53 for |x| <= 2^51, not for |x| <= 2^52.
+  k::TypeSignature Sig = Infer("def tiLinear(x) x*3+1");
+  EXPECT_EQ(Sig.Params, s::vector<k::NumKind>{k::NK_Int});
+  EXPECT_EQ(Sig.Ret, k::NK_Int);
+  EXPECT_EQ(Sig.ParamBound, std::ldexp(1.0, 51));
+  EXPECT_EQ(Sig.RetBound, 3 * std::ldexp(1.0, 51) + 1);
+}
+
+TEST_F(TypeInferTest, NoDemotionKeepsFullRange) {
+  k::TypeSignature Sig = Infer("def tiCompare(x y) x < y");
+  EXPECT_EQ(Sig.Ret, k::NK_Int);
+  EXPECT_EQ(Sig.ParamBound, k::MaxExactInt);
+}
+
+TEST_F(TypeInferTest, ResultPastExactRangeIsDouble) {
+  // Adding 2^53 leaves the exact range for any argument but 0: the body is
+  // done in double, and so the signature is generic.
+  k::TypeSignature Sig = Infer("def tiHuge(x) x + 9007199254740992");
+  EXPECT_TRUE(Sig.isGeneric());
+  EXPECT_EQ(Sig.Params, s::vector<k::NumKind>{k::NK_Double});
+}
+
+TEST_F(TypeInferTest, GuardFallsBackToDouble) {
+  const s::string Source = "def tiGuard(x) x*3+1;";
+  double Bound = std::ldexp(1.0, 51);
+  // In range, just past the clone's range on either side, past 2^53, and
+  // not integral.
+  s::vector<double> Args = {7, -7, Bound, Bound + 1, -Bound - 1, 4503599627370497.0, 1e300, 0.5};
+  s::vector<double> Generic = Apply(Source, "tiGuard", Args, false);
+  s::vector<double> Typed = Apply(Source, "tiGuard", Args, true);
+  ASSERT_TRUE(k::Signatures.count("tiGuard"));
+  EXPECT_EQ(k::Signatures["tiGuard"].ParamBound, Bound);
+  EXPECT_EQ(Typed, Generic);
+}
+
+TEST_F(TypeInferTest, SpecializedCallerMatchesGeneric) {
+  // A caller whose argument is out of the callee's range calls it through
+  // the guard.
+  const s::string Source = "def tiSquare(x) x*x; def tiCaller(x) tiSquare(x*1024);";
+  s::vector<double> Args = {3, 94906265, 94906267, -1e9, 0.25};
+  EXPECT_EQ(Apply(Source, "tiCaller", Args, true), Apply(Source, "tiCaller", Args, false));
+}